@@ -4,12 +4,23 @@
 #include <stdarg.h>
 #include "analyze.h"
 #include "print.h"
+#include "array.h"
+
+#define INLINE_MAX_COST  24
+#define MAX_CLONES       4
 
 static void a_block(Block *block);
 static void a_expr(Expr *expr);
 
 static Scope *cur_scope = 0;
 static Decl *cur_funcdecl = 0;
+static Decl **structs = 0;
+static Expr **func_calls = 0;
+static Stmt **tail_calls = 0;
+static Decl **clone_funcs = 0;
+static int64_t *clone_ids = 0;
+static Decl **memo_funcs = 0;
+static Stmt **loops = 0;
 
 static void add_used_var_to_func(Decl *decl)
 {
@@ -65,6 +76,14 @@ static void a_var(Expr *var)
 		error_at(var->ident, "%T is not declared", var->ident);
 	}
 	
+	if(var->decl->isstruct) {
+		error_at(var->ident, "struct %T can only be constructed", var->ident);
+	}
+	
+	if(cur_scope->hosting_func != var->decl->scope->hosting_func) {
+		var->decl->used_by_other_func = true;
+	}
+	
 	if(
 		var->decl->scope->parent &&
 		cur_scope->hosting_func != var->decl->scope->hosting_func
@@ -81,9 +100,90 @@ static void a_var(Expr *var)
 	}
 }
 
+static bool a_builtin(Expr *call)
+{
+	static const struct {
+		char *name;
+		int64_t min_args;
+		int64_t max_args;
+	} builtins[] = {
+		#define F(x, min_args, max_args) {#x, min_args, max_args},
+		BUILTINS(F)
+		#undef F
+	};
+	
+	Expr *callee = call->callee;
+	
+	if(callee->type != EX_VAR || lookup(callee->ident, cur_scope)) {
+		return false;
+	}
+	
+	for(int i=0; i < BUILTIN_COUNT; i++) {
+		if(strcmp(builtins[i].name, callee->ident->id) != 0) {
+			continue;
+		}
+		
+		int64_t min_args = builtins[i].min_args;
+		int64_t max_args = builtins[i].max_args;
+		
+		if(call->argcount < min_args || call->argcount > max_args) {
+			if(min_args == max_args) {
+				error_at(
+					call->start, "%T needs %i arguments but got %i",
+					callee->ident, min_args, call->argcount
+				);
+			}
+			else {
+				error_at(
+					call->start, "%T needs %i to %i arguments but got %i",
+					callee->ident, min_args, max_args, call->argcount
+				);
+			}
+		}
+		
+		call->is_builtin = true;
+		call->builtin = i;
+		return true;
+	}
+	
+	return false;
+}
+
+static bool a_new(Expr *call)
+{
+	Expr *callee = call->callee;
+	
+	if(callee->type != EX_VAR) {
+		return false;
+	}
+	
+	Decl *decl = lookup(callee->ident, cur_scope);
+	
+	if(!decl || !decl->isstruct) {
+		return false;
+	}
+	
+	if(call->argcount != array_length(decl->fields)) {
+		error_at(
+			call->start, "struct %T has %i fields but got %i values",
+			callee->ident, array_length(decl->fields), call->argcount
+		);
+	}
+	
+	call->type = EX_NEW;
+	call->structdecl = decl;
+	return true;
+}
+
 static void a_callexpr(Expr *call)
 {
-	a_expr(call->callee);
+	if(!a_builtin(call) && !a_new(call)) {
+		a_expr(call->callee);
+		
+		if(call->callee->type == EX_VAR && call->callee->decl->isfunc) {
+			array_push(func_calls, call);
+		}
+	}
 	
 	for(Expr *arg = call->args; arg; arg = arg->next) {
 		a_expr(arg);
@@ -102,6 +202,16 @@ static void a_array(Expr *array)
 	make_temporary(array);
 }
 
+static void a_map(Expr *map)
+{
+	for(Expr *item = map->items; item; item = item->next) {
+		a_expr(item);
+		map->has_tmps = map->has_tmps || item->has_tmps;
+	}
+	
+	make_temporary(map);
+}
+
 static Expr *array_get(Expr *array, int64_t index)
 {
 	Expr *item = array->items;
@@ -132,6 +242,145 @@ static void a_subscript(Expr *subscript)
 	}
 }
 
+static void a_slice(Expr *slice)
+{
+	a_expr(slice->array);
+	slice->has_tmps = slice->array->has_tmps;
+	
+	if(slice->index) {
+		a_expr(slice->index);
+		slice->has_tmps = slice->has_tmps || slice->index->has_tmps;
+	}
+	
+	if(slice->stop) {
+		a_expr(slice->stop);
+		slice->has_tmps = slice->has_tmps || slice->stop->has_tmps;
+	}
+	
+	make_temporary(slice);
+}
+
+static void a_field(Expr *field)
+{
+	a_expr(field->object);
+	field->has_tmps = field->object->has_tmps;
+	field->structdecl = 0;
+	int64_t found = 0;
+	
+	array_for(structs, i) {
+		Token **fields = structs[i]->fields;
+		
+		array_for(fields, j) {
+			if(fields[j]->id == field->field->id) {
+				field->structdecl = structs[i];
+				field->offset = j;
+				found ++;
+			}
+		}
+	}
+	
+	if(found == 0) {
+		error_at(field->field, "no struct has a field %T", field->field);
+	}
+	else if(found > 1) {
+		field->structdecl = 0;
+	}
+}
+
+static bool is_num_literal(Expr *expr)
+{
+	return
+		expr->type == EX_NULL || expr->type == EX_BOOL ||
+		expr->type == EX_INT || expr->type == EX_FLOAT;
+}
+
+// A variable that is initialized with a literal and never assigned again is
+// replaced by the literal where it is read, so the folding below can work on
+// it. A deferred initialization may run after reads from other functions, so
+// those keep reading the variable.
+
+static void propagate_var(Expr *var)
+{
+	Decl *decl = var->decl;
+	
+	if(
+		decl->isfunc || decl->is_param || decl->reassigned || !decl->init ||
+		!is_num_literal(decl->init) || decl->init_deferred &&
+		cur_scope->hosting_func != decl->scope->hosting_func
+	) {
+		return;
+	}
+	
+	Token *start = var->start;
+	Scope *scope = var->scope;
+	Expr *next = var->next;
+	*var = *decl->init;
+	var->start = start;
+	var->scope = scope;
+	var->next = next;
+}
+
+// Assignments can come after reads in the source, so they are found before
+// the analysis of the reads.
+
+static void collect_assigned(Block *block)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		if(stmt->type == ST_ASSIGN && stmt->target->type == EX_VAR) {
+			Decl *decl = lookup(stmt->target->ident, block->scope);
+			
+			if(decl) {
+				decl->reassigned = true;
+			}
+		}
+		else if(stmt->type == ST_FUNCDECL) {
+			collect_assigned(stmt->decl->body);
+		}
+		else if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
+			collect_assigned(stmt->body);
+			
+			if(stmt->type == ST_IF && stmt->else_body) {
+				collect_assigned(stmt->else_body);
+			}
+		}
+	}
+}
+
+static double literal_float(Expr *expr)
+{
+	return expr->type == EX_FLOAT ? expr->floatval : expr->value;
+}
+
+static void fold_float_binop(Expr *binop)
+{
+	int64_t op = binop->op->punct;
+	double left = literal_float(binop->left);
+	double right = literal_float(binop->right);
+	
+	if(binop->oplevel == OP_CMP) {
+		binop->type = EX_BOOL;
+		
+		binop->value =
+			op == '<' ? left < right :
+			op == '>' ? left > right :
+			op == IPUNCT("==") ? left == right :
+			op == IPUNCT("!=") ? left != right :
+			op == IPUNCT("<=") ? left <= right :
+			op == IPUNCT(">=") ? left >= right :
+			0 /* should never happen */;
+	}
+	else {
+		binop->type = EX_FLOAT;
+		
+		binop->floatval =
+			op == '+' ? left + right :
+			op == '-' ? left - right :
+			op == '*' ? left * right :
+			op == '/' ? left / right :
+			0 /* should never happen */;
+	}
+}
+
 static void a_binop(Expr *binop)
 {
 	Expr *left = binop->left;
@@ -140,14 +389,32 @@ static void a_binop(Expr *binop)
 	a_expr(left);
 	a_expr(right);
 	
-	if(binop->isconst) {
+	if(is_num_literal(left) && is_num_literal(right)) {
 		Token *op = binop->op;
 		int64_t oplevel = binop->oplevel;
+		bool isfloat = left->type == EX_FLOAT || right->type == EX_FLOAT;
+		binop->isconst = true;
+		
+		if(
+			op->punct == '%' && isfloat ||
+			(op->punct == '/' || op->punct == '%') && !isfloat &&
+			right->value == 0
+		) {
+			// leave the error to the runtime
+			binop->isconst = false;
+			return;
+		}
+		
+		if(isfloat) {
+			fold_float_binop(binop);
+			return;
+		}
 		
 		binop->value =
 			op->punct == '+' ? left->value + right->value :
 			op->punct == '-' ? left->value - right->value :
 			op->punct == '*' ? left->value * right->value :
+			op->punct == '/' ? left->value / right->value :
 			op->punct == '%' ? left->value % right->value :
 			op->punct == '<' ? left->value < right->value :
 			op->punct == '>' ? left->value > right->value :
@@ -160,24 +427,37 @@ static void a_binop(Expr *binop)
 		binop->type = oplevel == OP_CMP ? EX_BOOL : EX_INT;
 	}
 	else {
+		binop->isconst = false;
 		binop->has_tmps = left->has_tmps || right->has_tmps;
 	}
 }
 
 static void a_unary(Expr *unary)
 {
-	a_expr(unary->subexpr);
+	Expr *subexpr = unary->subexpr;
+	a_expr(subexpr);
 	
-	if(unary->isconst && unary->subexpr->type == EX_INT) {
+	if(subexpr->type == EX_FLOAT) {
+		unary->type = EX_FLOAT;
+		unary->isconst = true;
+		
+		unary->floatval =
+			unary->op->punct == '+' ? +subexpr->floatval :
+			unary->op->punct == '-' ? -subexpr->floatval :
+			0 /* should never happen */;
+	}
+	else if(is_num_literal(subexpr)) {
 		unary->type = EX_INT;
+		unary->isconst = true;
 		
 		unary->value =
-			unary->op->punct == '+' ? +unary->subexpr->value :
-			unary->op->punct == '-' ? -unary->subexpr->value :
+			unary->op->punct == '+' ? +subexpr->value :
+			unary->op->punct == '-' ? -subexpr->value :
 			0 /* should never happen */;
 	}
 	else {
-		unary->has_tmps = unary->subexpr->has_tmps;
+		unary->isconst = false;
+		unary->has_tmps = subexpr->has_tmps;
 	}
 }
 
@@ -186,6 +466,7 @@ static void a_expr(Expr *expr)
 	switch(expr->type) {
 		case EX_VAR:
 			a_var(expr);
+			propagate_var(expr);
 			break;
 		case EX_BINOP:
 			a_binop(expr);
@@ -202,13 +483,46 @@ static void a_expr(Expr *expr)
 		case EX_UNARY:
 			a_unary(expr);
 			break;
+		case EX_MAP:
+			a_map(expr);
+			break;
+		case EX_FIELD:
+			a_field(expr);
+			break;
+		case EX_SLICE:
+			a_slice(expr);
+			break;
 	}
 }
 
+static bool is_nonneg_int(Expr *expr)
+{
+	return expr->type == EX_INT && expr->value >= 0;
+}
+
+// A counter is only ever set to or incremented by a non-negative int literal.
+
+static bool is_counter_step(Decl *decl, Expr *value)
+{
+	return
+		is_nonneg_int(value) ||
+		value->type == EX_BINOP && value->op->punct == '+' &&
+		value->left->type == EX_VAR && value->left->decl == decl &&
+		is_nonneg_int(value->right);
+}
+
 static void a_vardecl(Decl *vardecl)
 {
+	if(!vardecl->init || !is_nonneg_int(vardecl->init)) {
+		vardecl->maybe_negative = true;
+	}
+	
 	if(vardecl->init) {
 		a_expr(vardecl->init);
+		
+		if(!vardecl->init->isconst) {
+			vardecl->init_deferred = true;
+		}
 	}
 }
 
@@ -220,6 +534,15 @@ static void a_assign(Stmt *assign)
 	if(assign->target->islvalue == 0) {
 		error_at(assign->start, "target is not assignable");
 	}
+	
+	if(assign->target->type == EX_VAR) {
+		Decl *decl = assign->target->decl;
+		decl->reassigned = true;
+		
+		if(!is_counter_step(decl, assign->value)) {
+			decl->maybe_negative = true;
+		}
+	}
 }
 
 static void a_print(Stmt *print)
@@ -237,6 +560,10 @@ static void a_funcdecl(Decl *funcdecl)
 	funcdecl->body->scope->hosting_func = funcdecl;
 	a_block(funcdecl->body);
 	cur_funcdecl = old_funcdecl;
+	
+	if(funcdecl->memo_size > 0) {
+		array_push(memo_funcs, funcdecl);
+	}
 }
 
 static void a_call(Stmt *call)
@@ -255,6 +582,15 @@ static void a_return(Stmt *returnstmt)
 	
 	if(returnstmt->value) {
 		a_expr(returnstmt->value);
+		Expr *value = returnstmt->value;
+		
+		if(
+			value->type == EX_CALL && !value->is_builtin &&
+			value->callee->type == EX_VAR &&
+			value->callee->decl == cur_funcdecl
+		) {
+			array_push(tail_calls, returnstmt);
+		}
 	}
 }
 
@@ -272,6 +608,7 @@ static void a_while(Stmt *stmt)
 {
 	a_expr(stmt->cond);
 	a_block(stmt->body);
+	array_push(loops, stmt);
 }
 
 static void a_stmt(Stmt *stmt)
@@ -319,8 +656,1088 @@ static void a_block(Block *block)
 	cur_scope = cur_scope->parent;
 }
 
+static void collect_structs(Block *block)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		if(stmt->type == ST_STRUCTDECL) {
+			array_push(structs, stmt->decl);
+		}
+		else if(stmt->type == ST_FUNCDECL) {
+			collect_structs(stmt->decl->body);
+		}
+		else if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
+			collect_structs(stmt->body);
+			
+			if(stmt->type == ST_IF && stmt->else_body) {
+				collect_structs(stmt->else_body);
+			}
+		}
+	}
+}
+
+bool is_int_type(DataType dtype)
+{
+	return dtype == DT_NULL || dtype == DT_BOOL || dtype == DT_INT;
+}
+
+bool is_num_type(DataType dtype)
+{
+	return is_int_type(dtype) || dtype == DT_FLOAT;
+}
+
+// Variables that are only ever accessed by their own function can get a
+// static type. It is the join of the types of all values assigned to them,
+// found by iterating over the whole module until nothing changes anymore.
+
+static bool dtypes_changed = false;
+
+static bool has_static_type(Decl *decl)
+{
+	return
+		!decl->isfunc && !decl->isstruct &&
+		(!decl->is_param || decl->specialized) && !decl->used_by_other_func;
+}
+
+static void join_dtype(Decl *decl, DataType dtype)
+{
+	DataType joined =
+		decl->dtype == DT_NONE || decl->dtype == dtype ? dtype :
+		dtype == DT_NONE ? decl->dtype :
+		DT_ANY;
+	
+	if(joined != decl->dtype) {
+		decl->dtype = joined;
+		dtypes_changed = true;
+	}
+}
+
+static DataType t_expr(Expr *expr);
+
+static DataType t_binop(Expr *binop)
+{
+	DataType left = t_expr(binop->left);
+	DataType right = t_expr(binop->right);
+	
+	if(binop->oplevel == OP_CMP) {
+		return DT_BOOL;
+	}
+	else if(left == DT_NONE || right == DT_NONE) {
+		return DT_NONE;
+	}
+	else if(is_int_type(left) && is_int_type(right)) {
+		return DT_INT;
+	}
+	else if(
+		is_num_type(left) && is_num_type(right) && binop->op->punct != '%'
+	) {
+		return DT_FLOAT;
+	}
+	
+	return DT_ANY;
+}
+
+static DataType t_unary(Expr *unary)
+{
+	DataType subexpr = t_expr(unary->subexpr);
+	
+	if(subexpr == DT_NONE || subexpr == DT_FLOAT) {
+		return subexpr;
+	}
+	else if(is_int_type(subexpr)) {
+		return DT_INT;
+	}
+	
+	return DT_ANY;
+}
+
+static DataType t_expr(Expr *expr)
+{
+	switch(expr->type) {
+		case EX_NULL:
+			expr->dtype = DT_NULL;
+			break;
+		case EX_BOOL:
+			expr->dtype = DT_BOOL;
+			break;
+		case EX_INT:
+			expr->dtype = DT_INT;
+			break;
+		case EX_FLOAT:
+			expr->dtype = DT_FLOAT;
+			break;
+		case EX_VAR:
+			expr->dtype =
+				has_static_type(expr->decl) ? expr->decl->dtype : DT_ANY;
+			
+			break;
+		case EX_BINOP:
+			expr->dtype = t_binop(expr);
+			break;
+		case EX_UNARY:
+			expr->dtype = t_unary(expr);
+			break;
+		case EX_CALL:
+			if(!expr->is_builtin) {
+				t_expr(expr->callee);
+			}
+			
+			// fallthrough
+		case EX_NEW:
+			for(Expr *arg = expr->args; arg; arg = arg->next) {
+				t_expr(arg);
+			}
+			
+			expr->dtype = DT_ANY;
+			break;
+		case EX_ARRAY:
+		case EX_MAP:
+			for(Expr *item = expr->items; item; item = item->next) {
+				t_expr(item);
+			}
+			
+			expr->dtype = DT_ANY;
+			break;
+		case EX_SUBSCRIPT:
+			t_expr(expr->array);
+			t_expr(expr->index);
+			expr->dtype = DT_ANY;
+			break;
+		case EX_FIELD:
+			t_expr(expr->object);
+			expr->dtype = DT_ANY;
+			break;
+		case EX_SLICE:
+			t_expr(expr->array);
+			
+			if(expr->index) {
+				t_expr(expr->index);
+			}
+			
+			if(expr->stop) {
+				t_expr(expr->stop);
+			}
+			
+			expr->dtype = DT_ANY;
+			break;
+		default:
+			expr->dtype = DT_ANY;
+			break;
+	}
+	
+	return expr->dtype;
+}
+
+static void t_block(Block *block)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		switch(stmt->type) {
+			case ST_VARDECL:
+				join_dtype(
+					stmt->decl,
+					stmt->decl->init ? t_expr(stmt->decl->init) : DT_NULL
+				);
+				
+				break;
+			case ST_ASSIGN:
+				t_expr(stmt->target);
+				t_expr(stmt->value);
+				
+				if(stmt->target->type == EX_VAR) {
+					join_dtype(stmt->target->decl, stmt->value->dtype);
+				}
+				
+				break;
+			case ST_PRINT:
+				for(Expr *value = stmt->values; value; value = value->next) {
+					t_expr(value);
+				}
+				
+				break;
+			case ST_FUNCDECL:
+				t_block(stmt->decl->body);
+				break;
+			case ST_CALL:
+				t_expr(stmt->call);
+				break;
+			case ST_RETURN:
+				if(stmt->value) {
+					t_expr(stmt->value);
+				}
+				
+				break;
+			case ST_IF:
+			case ST_WHILE:
+				t_expr(stmt->cond);
+				t_block(stmt->body);
+				
+				if(stmt->type == ST_IF && stmt->else_body) {
+					t_block(stmt->else_body);
+				}
+				
+				break;
+		}
+	}
+}
+
+static void infer_types(Block *body)
+{
+	do {
+		dtypes_changed = false;
+		t_block(body);
+	} while(dtypes_changed);
+}
+
+static void reset_dtypes(Block *block)
+{
+	for(Decl *decl = block->scope->decls; decl; decl = decl->next) {
+		decl->dtype = DT_NONE;
+	}
+	
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		if(stmt->type == ST_FUNCDECL) {
+			reset_dtypes(stmt->decl->body);
+		}
+		else if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
+			reset_dtypes(stmt->body);
+			
+			if(stmt->type == ST_IF && stmt->else_body) {
+				reset_dtypes(stmt->else_body);
+			}
+		}
+	}
+}
+
+// A function gets a clone for every combination of int and float argument types
+// it is called with directly. Inside a clone those parameters have a static
+// type, so the arithmetic on them is native. Clone 0 is the generic function.
+
+static DataType param_dtype(DataType dtype)
+{
+	return dtype == DT_INT || dtype == DT_FLOAT ? dtype : DT_ANY;
+}
+
+int64_t call_clone(Expr *call)
+{
+	DataType **clones = call->callee->decl->clones;
+	
+	array_for(clones, i) {
+		int64_t k = 0;
+		Expr *arg = call->args;
+		
+		while(arg && param_dtype(arg->dtype) == clones[i][k]) {
+			arg = arg->next;
+			k ++;
+		}
+		
+		if(!arg) {
+			return i + 1;
+		}
+	}
+	
+	return 0;
+}
+
+void specialize(Decl *func, int64_t clone)
+{
+	reset_dtypes(func->body);
+	
+	array_for(func->params, i) {
+		Decl *param = lookup(func->params[i], func->body->scope);
+		DataType dtype = clone > 0 ? func->clones[clone - 1][i] : DT_ANY;
+		param->specialized = dtype != DT_ANY;
+		param->dtype = param->specialized ? dtype : DT_NONE;
+	}
+	
+	infer_types(func->body);
+}
+
+static void add_clone(Expr *call)
+{
+	Decl *func = call->callee->decl;
+	bool typed = false;
+	
+	for(Expr *arg = call->args; arg; arg = arg->next) {
+		typed = typed || param_dtype(arg->dtype) != DT_ANY;
+	}
+	
+	if(
+		!typed || call_clone(call) > 0 ||
+		array_length(func->clones) >= MAX_CLONES
+	) {
+		return;
+	}
+	
+	DataType *clone = malloc(call->argcount * sizeof(DataType));
+	int64_t k = 0;
+	
+	for(Expr *arg = call->args; arg; arg = arg->next, k++) {
+		clone[k] = param_dtype(arg->dtype);
+	}
+	
+	array_push(func->clones, clone);
+	int64_t id = array_length(func->clones);
+	array_push(clone_funcs, func);
+	array_push(clone_ids, id);
+}
+
+static void collect_clones_block(Block *block);
+
+static void collect_clones_expr(Expr *expr)
+{
+	switch(expr->type) {
+		case EX_BINOP:
+			collect_clones_expr(expr->left);
+			collect_clones_expr(expr->right);
+			break;
+		case EX_UNARY:
+			collect_clones_expr(expr->subexpr);
+			break;
+		case EX_CALL:
+			if(!expr->is_builtin) {
+				collect_clones_expr(expr->callee);
+			}
+			
+			if(expr->is_direct) {
+				add_clone(expr);
+			}
+			
+			// fallthrough
+		case EX_NEW:
+			for(Expr *arg = expr->args; arg; arg = arg->next) {
+				collect_clones_expr(arg);
+			}
+			
+			break;
+		case EX_ARRAY:
+		case EX_MAP:
+			for(Expr *item = expr->items; item; item = item->next) {
+				collect_clones_expr(item);
+			}
+			
+			break;
+		case EX_SUBSCRIPT:
+			collect_clones_expr(expr->array);
+			collect_clones_expr(expr->index);
+			break;
+		case EX_FIELD:
+			collect_clones_expr(expr->object);
+			break;
+		case EX_SLICE:
+			collect_clones_expr(expr->array);
+			
+			if(expr->index) {
+				collect_clones_expr(expr->index);
+			}
+			
+			if(expr->stop) {
+				collect_clones_expr(expr->stop);
+			}
+			
+			break;
+	}
+}
+
+static void collect_clones_block(Block *block)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		switch(stmt->type) {
+			case ST_VARDECL:
+				if(stmt->decl->init) {
+					collect_clones_expr(stmt->decl->init);
+				}
+				
+				break;
+			case ST_ASSIGN:
+				collect_clones_expr(stmt->target);
+				collect_clones_expr(stmt->value);
+				break;
+			case ST_PRINT:
+				for(Expr *value = stmt->values; value; value = value->next) {
+					collect_clones_expr(value);
+				}
+				
+				break;
+			case ST_FUNCDECL:
+				collect_clones_block(stmt->decl->body);
+				break;
+			case ST_CALL:
+				collect_clones_expr(stmt->call);
+				break;
+			case ST_RETURN:
+				if(stmt->value) {
+					collect_clones_expr(stmt->value);
+				}
+				
+				break;
+			case ST_IF:
+			case ST_WHILE:
+				collect_clones_expr(stmt->cond);
+				collect_clones_block(stmt->body);
+				
+				if(stmt->type == ST_IF && stmt->else_body) {
+					collect_clones_block(stmt->else_body);
+				}
+				
+				break;
+		}
+	}
+}
+
+// The calls inside a clone can ask for further clones, so every new clone is
+// inferred and scanned in turn.
+
+static void find_clones(Block *body)
+{
+	collect_clones_block(body);
+	
+	for(int64_t i=0; i < array_length(clone_funcs); i++) {
+		specialize(clone_funcs[i], clone_ids[i]);
+		collect_clones_block(clone_funcs[i]->body);
+		specialize(clone_funcs[i], 0);
+	}
+}
+
+// Small functions that call no other functions and enclose no variables are
+// inlined at their direct call sites. The cost is the number of statements and
+// expression nodes, anything that can not be inlined costs too much.
+
+static int64_t inline_cost_block(Block *block);
+
+static int64_t inline_cost_expr(Expr *expr)
+{
+	int64_t cost = 1;
+	
+	switch(expr->type) {
+		case EX_BINOP:
+			cost += inline_cost_expr(expr->left);
+			cost += inline_cost_expr(expr->right);
+			break;
+		case EX_UNARY:
+			cost += inline_cost_expr(expr->subexpr);
+			break;
+		case EX_CALL:
+			if(!expr->is_builtin) {
+				return INLINE_MAX_COST + 1;
+			}
+			
+			// fallthrough
+		case EX_NEW:
+			for(Expr *arg = expr->args; arg; arg = arg->next) {
+				cost += inline_cost_expr(arg);
+			}
+			
+			break;
+		case EX_ARRAY:
+		case EX_MAP:
+			for(Expr *item = expr->items; item; item = item->next) {
+				cost += inline_cost_expr(item);
+			}
+			
+			break;
+		case EX_SUBSCRIPT:
+			cost += inline_cost_expr(expr->array);
+			cost += inline_cost_expr(expr->index);
+			break;
+		case EX_FIELD:
+			cost += inline_cost_expr(expr->object);
+			break;
+		case EX_SLICE:
+			cost += inline_cost_expr(expr->array);
+			
+			if(expr->index) {
+				cost += inline_cost_expr(expr->index);
+			}
+			
+			if(expr->stop) {
+				cost += inline_cost_expr(expr->stop);
+			}
+			
+			break;
+	}
+	
+	return cost;
+}
+
+static int64_t inline_cost_block(Block *block)
+{
+	int64_t cost = 0;
+	
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		cost ++;
+		
+		switch(stmt->type) {
+			case ST_VARDECL:
+				if(stmt->decl->init) {
+					cost += inline_cost_expr(stmt->decl->init);
+				}
+				
+				break;
+			case ST_ASSIGN:
+				cost += inline_cost_expr(stmt->target);
+				cost += inline_cost_expr(stmt->value);
+				break;
+			case ST_PRINT:
+				for(Expr *value = stmt->values; value; value = value->next) {
+					cost += inline_cost_expr(value);
+				}
+				
+				break;
+			case ST_CALL:
+				cost += inline_cost_expr(stmt->call);
+				break;
+			case ST_RETURN:
+				if(stmt->value) {
+					cost += inline_cost_expr(stmt->value);
+				}
+				
+				break;
+			case ST_IF:
+			case ST_WHILE:
+				cost += inline_cost_expr(stmt->cond);
+				cost += inline_cost_block(stmt->body);
+				
+				if(stmt->type == ST_IF && stmt->else_body) {
+					cost += inline_cost_block(stmt->else_body);
+				}
+				
+				break;
+			case ST_FUNCDECL:
+			case ST_STRUCTDECL:
+				return INLINE_MAX_COST + 1;
+		}
+		
+		if(cost > INLINE_MAX_COST) {
+			break;
+		}
+	}
+	
+	return cost;
+}
+
+static bool is_inlinable(Decl *func)
+{
+	return
+		!func->enclosed && func->memo_size == 0 &&
+		inline_cost_block(func->body) <= INLINE_MAX_COST;
+}
+
+// Calls to a function declaration that is never assigned to can skip the
+// generic call() and jump straight to the compiled function.
+
+static void resolve_direct_calls()
+{
+	for(int64_t i=0; i < array_length(func_calls); i++) {
+		Expr *call = func_calls[i];
+		Decl *func = call->callee->decl;
+		
+		if(func->reassigned) {
+			continue;
+		}
+		
+		if(call->argcount != array_length(func->params)) {
+			error_at(
+				call->start, "%T needs %i arguments but got %i",
+				func->ident, array_length(func->params), call->argcount
+			);
+		}
+		
+		// the function value exists already, if the call comes after the
+		// declaration in the same function or is a call of itself
+		Decl *caller = call->scope->hosting_func;
+		
+		call->is_direct = true;
+		call->is_inline = is_inlinable(func);
+		
+		call->callee_declared =
+			caller == func ||
+			caller == func->scope->hosting_func && call->start >= func->end;
+	}
+	
+	// a direct call of the enclosing function in a return is a tail call
+	for(int64_t i=0; i < array_length(tail_calls); i++) {
+		Stmt *returnstmt = tail_calls[i];
+		
+		if(returnstmt->value->is_direct) {
+			returnstmt->is_tail_call = true;
+			returnstmt->value->callee->decl->has_tail_calls = true;
+		}
+	}
+}
+
+// The result of a memo function may only depend on its arguments. It must not
+// read or write variables of other functions, print, mutate items or fields, or
+// call anything but builtins without side effects and other memo functions.
+
+static bool is_pure_builtin(Builtin builtin)
+{
+	switch(builtin) {
+		case BI_push:
+		case BI_pop:
+		case BI_push_front:
+		case BI_pop_front:
+		case BI_pq_push:
+		case BI_pq_pop:
+		case BI_fill:
+		case BI_copy:
+		case BI_sort:
+		case BI_clock:
+		case BI_set:
+		case BI_clear:
+		case BI_union:
+		case BI_intersect:
+		case BI_erase:
+			return false;
+	}
+	
+	return true;
+}
+
+static void check_pure_block(Block *block, Decl *func);
+
+static void check_pure_expr(Expr *expr, Decl *func)
+{
+	switch(expr->type) {
+		case EX_VAR:
+			if(
+				!expr->decl->isfunc &&
+				expr->decl->scope->hosting_func != func
+			) {
+				error_at(
+					expr->start, "memo function %T can not use outer %T",
+					func->ident, expr->ident
+				);
+			}
+			
+			break;
+		case EX_BINOP:
+			check_pure_expr(expr->left, func);
+			check_pure_expr(expr->right, func);
+			break;
+		case EX_UNARY:
+			check_pure_expr(expr->subexpr, func);
+			break;
+		case EX_CALL:
+			if(expr->is_builtin) {
+				if(!is_pure_builtin(expr->builtin)) {
+					error_at(
+						expr->start, "memo function %T can not call %T",
+						func->ident, expr->callee->ident
+					);
+				}
+			}
+			else if(
+				!expr->is_direct || expr->callee->decl->memo_size == 0
+			) {
+				error_at(
+					expr->start,
+					"memo function %T can only call other memo functions",
+					func->ident
+				);
+			}
+			
+			// fallthrough
+		case EX_NEW:
+			for(Expr *arg = expr->args; arg; arg = arg->next) {
+				check_pure_expr(arg, func);
+			}
+			
+			break;
+		case EX_ARRAY:
+		case EX_MAP:
+			for(Expr *item = expr->items; item; item = item->next) {
+				check_pure_expr(item, func);
+			}
+			
+			break;
+		case EX_SUBSCRIPT:
+			check_pure_expr(expr->array, func);
+			check_pure_expr(expr->index, func);
+			break;
+		case EX_FIELD:
+			check_pure_expr(expr->object, func);
+			break;
+		case EX_SLICE:
+			check_pure_expr(expr->array, func);
+			
+			if(expr->index) {
+				check_pure_expr(expr->index, func);
+			}
+			
+			if(expr->stop) {
+				check_pure_expr(expr->stop, func);
+			}
+			
+			break;
+	}
+}
+
+static void check_pure_block(Block *block, Decl *func)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		switch(stmt->type) {
+			case ST_VARDECL:
+				if(stmt->decl->init) {
+					check_pure_expr(stmt->decl->init, func);
+				}
+				
+				break;
+			case ST_ASSIGN:
+				if(stmt->target->type != EX_VAR) {
+					error_at(
+						stmt->start,
+						"memo function %T can not assign items or fields",
+						func->ident
+					);
+				}
+				
+				check_pure_expr(stmt->target, func);
+				check_pure_expr(stmt->value, func);
+				break;
+			case ST_PRINT:
+				error_at(
+					stmt->start, "memo function %T can not print", func->ident
+				);
+				
+				break;
+			case ST_FUNCDECL:
+				error_at(
+					stmt->start, "memo function %T can not declare functions",
+					func->ident
+				);
+				
+				break;
+			case ST_CALL:
+				check_pure_expr(stmt->call, func);
+				break;
+			case ST_RETURN:
+				if(stmt->value) {
+					check_pure_expr(stmt->value, func);
+				}
+				
+				break;
+			case ST_IF:
+			case ST_WHILE:
+				check_pure_expr(stmt->cond, func);
+				check_pure_block(stmt->body, func);
+				
+				if(stmt->type == ST_IF && stmt->else_body) {
+					check_pure_block(stmt->else_body, func);
+				}
+				
+				break;
+		}
+	}
+}
+
+// In a loop "while i < len(a)" with a counter i, every a[i] is in range until
+// the loop body assigns i again, as long as the body can not reassign a or
+// shrink any array. Such subscripts skip the index checks.
+
+static bool is_counter(Decl *decl)
+{
+	return !decl->isfunc && !decl->is_param && !decl->maybe_negative;
+}
+
+static bool keeps_lengths_expr(Expr *expr, Decl *array)
+{
+	switch(expr->type) {
+		case EX_BINOP:
+			return
+				keeps_lengths_expr(expr->left, array) &&
+				keeps_lengths_expr(expr->right, array);
+		case EX_UNARY:
+			return keeps_lengths_expr(expr->subexpr, array);
+		case EX_CALL:
+			if(
+				!expr->is_builtin ||
+				!is_pure_builtin(expr->builtin) && expr->builtin != BI_push
+			) {
+				return false;
+			}
+			
+			// fallthrough
+		case EX_NEW:
+			for(Expr *arg = expr->args; arg; arg = arg->next) {
+				if(!keeps_lengths_expr(arg, array)) {
+					return false;
+				}
+			}
+			
+			return true;
+		case EX_ARRAY:
+		case EX_MAP:
+			for(Expr *item = expr->items; item; item = item->next) {
+				if(!keeps_lengths_expr(item, array)) {
+					return false;
+				}
+			}
+			
+			return true;
+		case EX_SUBSCRIPT:
+			return
+				keeps_lengths_expr(expr->array, array) &&
+				keeps_lengths_expr(expr->index, array);
+		case EX_FIELD:
+			return keeps_lengths_expr(expr->object, array);
+		case EX_SLICE:
+			return
+				keeps_lengths_expr(expr->array, array) &&
+				(!expr->index || keeps_lengths_expr(expr->index, array)) &&
+				(!expr->stop || keeps_lengths_expr(expr->stop, array));
+	}
+	
+	return true;
+}
+
+static bool keeps_lengths_block(Block *block, Decl *array)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		bool keeps = true;
+		
+		switch(stmt->type) {
+			case ST_VARDECL:
+				keeps = !stmt->decl->init ||
+					keeps_lengths_expr(stmt->decl->init, array);
+				
+				break;
+			case ST_ASSIGN:
+				keeps =
+					!(
+						stmt->target->type == EX_VAR &&
+						stmt->target->decl == array
+					) &&
+					keeps_lengths_expr(stmt->target, array) &&
+					keeps_lengths_expr(stmt->value, array);
+				
+				break;
+			case ST_PRINT:
+				for(Expr *value = stmt->values; value; value = value->next) {
+					keeps = keeps && keeps_lengths_expr(value, array);
+				}
+				
+				break;
+			case ST_CALL:
+				keeps = keeps_lengths_expr(stmt->call, array);
+				break;
+			case ST_RETURN:
+				keeps = !stmt->value || keeps_lengths_expr(stmt->value, array);
+				break;
+			case ST_IF:
+			case ST_WHILE:
+				keeps =
+					keeps_lengths_expr(stmt->cond, array) &&
+					keeps_lengths_block(stmt->body, array) && (
+						stmt->type != ST_IF || !stmt->else_body ||
+						keeps_lengths_block(stmt->else_body, array)
+					);
+				
+				break;
+		}
+		
+		if(!keeps) {
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+static bool assigns_var(Block *block, Decl *decl)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		if(
+			stmt->type == ST_ASSIGN && stmt->target->type == EX_VAR &&
+			stmt->target->decl == decl
+		) {
+			return true;
+		}
+		else if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
+			if(
+				assigns_var(stmt->body, decl) ||
+				stmt->type == ST_IF && stmt->else_body &&
+				assigns_var(stmt->else_body, decl)
+			) {
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+static void mark_safe_expr(Expr *expr, Decl *array, Decl *index)
+{
+	switch(expr->type) {
+		case EX_BINOP:
+			mark_safe_expr(expr->left, array, index);
+			mark_safe_expr(expr->right, array, index);
+			break;
+		case EX_UNARY:
+			mark_safe_expr(expr->subexpr, array, index);
+			break;
+		case EX_CALL:
+		case EX_NEW:
+			for(Expr *arg = expr->args; arg; arg = arg->next) {
+				mark_safe_expr(arg, array, index);
+			}
+			
+			break;
+		case EX_ARRAY:
+		case EX_MAP:
+			for(Expr *item = expr->items; item; item = item->next) {
+				mark_safe_expr(item, array, index);
+			}
+			
+			break;
+		case EX_SUBSCRIPT:
+			expr->is_safe_index =
+				expr->array->type == EX_VAR && expr->array->decl == array &&
+				expr->index->type == EX_VAR && expr->index->decl == index;
+			
+			mark_safe_expr(expr->array, array, index);
+			mark_safe_expr(expr->index, array, index);
+			break;
+		case EX_FIELD:
+			mark_safe_expr(expr->object, array, index);
+			break;
+		case EX_SLICE:
+			mark_safe_expr(expr->array, array, index);
+			
+			if(expr->index) {
+				mark_safe_expr(expr->index, array, index);
+			}
+			
+			if(expr->stop) {
+				mark_safe_expr(expr->stop, array, index);
+			}
+			
+			break;
+	}
+}
+
+// returns false as soon as the index may have changed
+
+static bool mark_safe_block(Block *block, Decl *array, Decl *index)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		switch(stmt->type) {
+			case ST_VARDECL:
+				if(stmt->decl->init) {
+					mark_safe_expr(stmt->decl->init, array, index);
+				}
+				
+				break;
+			case ST_ASSIGN:
+				mark_safe_expr(stmt->target, array, index);
+				mark_safe_expr(stmt->value, array, index);
+				
+				if(
+					stmt->target->type == EX_VAR &&
+					stmt->target->decl == index
+				) {
+					return false;
+				}
+				
+				break;
+			case ST_PRINT:
+				for(Expr *value = stmt->values; value; value = value->next) {
+					mark_safe_expr(value, array, index);
+				}
+				
+				break;
+			case ST_CALL:
+				mark_safe_expr(stmt->call, array, index);
+				break;
+			case ST_RETURN:
+				if(stmt->value) {
+					mark_safe_expr(stmt->value, array, index);
+				}
+				
+				break;
+			case ST_IF:
+				mark_safe_expr(stmt->cond, array, index);
+				
+				if(
+					!mark_safe_block(stmt->body, array, index) ||
+					stmt->else_body &&
+					!mark_safe_block(stmt->else_body, array, index)
+				) {
+					return false;
+				}
+				
+				break;
+			case ST_WHILE:
+				if(assigns_var(stmt->body, index)) {
+					return false;
+				}
+				
+				mark_safe_expr(stmt->cond, array, index);
+				mark_safe_block(stmt->body, array, index);
+				break;
+		}
+	}
+	
+	return true;
+}
+
+static void eliminate_bounds_checks()
+{
+	array_for(loops, i) {
+		Stmt *loop = loops[i];
+		Expr *cond = loop->cond;
+		
+		if(cond->type != EX_BINOP || cond->oplevel != OP_CMP) {
+			continue;
+		}
+		
+		Expr *index = cond->left;
+		Expr *length = cond->right;
+		
+		if(cond->op->punct == '>') {
+			index = cond->right;
+			length = cond->left;
+		}
+		else if(cond->op->punct != '<') {
+			continue;
+		}
+		
+		if(
+			index->type != EX_VAR || !is_counter(index->decl) ||
+			length->type != EX_CALL || !length->is_builtin ||
+			length->builtin != BI_len || length->args->type != EX_VAR
+		) {
+			continue;
+		}
+		
+		Decl *array = length->args->decl;
+		
+		if(array != index->decl && keeps_lengths_block(loop->body, array)) {
+			mark_safe_block(loop->body, array, index->decl);
+			loop->counted_array = array;
+		}
+	}
+}
+
 void analyze(Module *module)
 {
 	cur_scope = 0;
+	structs = 0;
+	func_calls = 0;
+	tail_calls = 0;
+	memo_funcs = 0;
+	loops = 0;
+	clone_funcs = 0;
+	clone_ids = 0;
+	collect_structs(module->body);
+	collect_assigned(module->body);
 	a_block(module->body);
+	resolve_direct_calls();
+	
+	array_for(memo_funcs, i) {
+		check_pure_block(memo_funcs[i]->body, memo_funcs[i]);
+	}
+	
+	eliminate_bounds_checks();
+	infer_types(module->body);
+	find_clones(module->body);
 }
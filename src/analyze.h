@@ -4,5 +4,9 @@
 #include "parse.h"
 
 void analyze(Module *module);
+bool is_int_type(DataType dtype);
+bool is_num_type(DataType dtype);
+int64_t call_clone(Expr *call);
+void specialize(Decl *func, int64_t clone);
 
 #endif
@@ -17,11 +17,50 @@
 	f(if) \
 	f(else) \
 	f(while) \
+	f(struct) \
+	f(memo) \
+
+#define BUILTINS(f) \
+	f(len, 1, 1) \
+	f(push, 2, 2) \
+	f(pop, 1, 1) \
+	f(deque, 0, 0) \
+	f(push_front, 2, 2) \
+	f(pop_front, 1, 1) \
+	f(pqueue, 0, 0) \
+	f(pq_push, 3, 3) \
+	f(pq_pop, 1, 1) \
+	f(int64_array, 1, 1) \
+	f(int32_array, 1, 1) \
+	f(uint8_array, 1, 1) \
+	f(fill, 2, 2) \
+	f(copy, 5, 5) \
+	f(equal, 2, 2) \
+	f(sort, 1, 2) \
+	f(clock, 0, 0) \
+	f(bitset, 1, 1) \
+	f(set, 2, 2) \
+	f(clear, 2, 2) \
+	f(test, 2, 2) \
+	f(union, 2, 2) \
+	f(intersect, 2, 2) \
+	f(count, 1, 1) \
+	f(has, 2, 2) \
+	f(erase, 2, 2) \
+	f(keys, 1, 1) \
+	f(omap, 0, 0) \
+	f(lower_bound, 2, 2) \
+
+#define MEMO_POLICIES(f) \
+	f(lru, MEMO_LRU) \
+	f(fifo, MEMO_FIFO) \
+	f(keep, MEMO_KEEP) \
 
 typedef enum {
 	TK_KEYWORD,
 	TK_IDENT,
 	TK_INT,
+	TK_FLOAT,
 	TK_STRING,
 	TK_PUNCT,
 	TK_EOF,
@@ -34,6 +73,20 @@ typedef enum {
 	KEYWORD_COUNT
 } Keyword;
 
+typedef enum {
+	#define F(x, min_args, max_args) BI_ ## x,
+	BUILTINS(F)
+	#undef F
+	BUILTIN_COUNT
+} Builtin;
+
+typedef enum {
+	#define F(x, runtime_name) MP_ ## x,
+	MEMO_POLICIES(F)
+	#undef F
+	MEMO_POLICY_COUNT
+} MemoPolicy;
+
 typedef struct Token {
 	TokenType type;
 	int64_t line;
@@ -46,6 +99,7 @@ typedef struct Token {
 		char *id;
 		char *text;
 		int64_t value;
+		double floatval;
 		int64_t punct;
 	};
 } Token;
@@ -54,6 +108,7 @@ typedef enum {
 	EX_NULL,
 	EX_BOOL,
 	EX_INT,
+	EX_FLOAT,
 	EX_STRING,
 	EX_VAR,
 	EX_BINOP,
@@ -61,8 +116,23 @@ typedef enum {
 	EX_ARRAY,
 	EX_SUBSCRIPT,
 	EX_UNARY,
+	EX_MAP,
+	EX_NEW,
+	EX_FIELD,
+	EX_SLICE,
 } ExprType;
 
+// static type of an expression or variable as inferred by the analyzer:
+// DT_NONE is not inferred yet, DT_ANY can be any type at runtime
+typedef enum {
+	DT_NONE,
+	DT_NULL,
+	DT_BOOL,
+	DT_INT,
+	DT_FLOAT,
+	DT_ANY,
+} DataType;
+
 typedef enum {
 	OP_CMP,
 	OP_ADD,
@@ -75,6 +145,12 @@ typedef struct Expr {
 	bool isconst : 1;
 	bool islvalue : 1;
 	bool has_tmps : 1;
+	bool is_builtin : 1;
+	bool is_direct : 1;
+	bool is_inline : 1;
+	bool is_safe_index : 1;
+	bool callee_declared : 1;
+	DataType dtype;
 	int64_t tmp_id;
 	Token *start;
 	struct Scope *scope;
@@ -82,30 +158,38 @@ typedef struct Expr {
 	
 	union {
 		int64_t value; // int, bool
+		double floatval; // float
 		char *string; // string
 		Token *ident; // var
 		struct Expr *callee; // call
 		struct Expr *left; // binop
-		struct Expr *items; // array
-		struct Expr *array; // subscript
+		struct Expr *items; // array, map
+		struct Expr *array; // subscript, slice
 		struct Expr *subexpr; // unary
+		struct Expr *object; // field
 	};
 	
 	union {
 		struct Expr *right; // binop
-		int64_t length; // array
-		struct Expr *index; // subscript
+		int64_t length; // array, map
+		struct Expr *index; // subscript, slice
 		struct Decl *decl; // var
+		Builtin builtin; // call
+		struct Decl *structdecl; // new, field
 	};
 	
 	union {
 		Token *op; // binop, unary
-		struct Expr *args; // call
+		struct Expr *args; // call, new
+		Token *field; // field
+		struct Expr *stop; // slice
 	};
 	
 	union {
-		int64_t argcount; // call
+		int64_t argcount; // call, new
 		OpLevel oplevel; // binop
+		int64_t offset; // field
+		int64_t template_id; // array
 	};
 } Expr;
 
@@ -121,7 +205,14 @@ typedef struct Decl {
 	Token *ident;
 	Token *end;
 	bool isfunc : 1;
+	bool isstruct : 1;
 	bool init_deferred : 1;
+	bool used_by_other_func : 1;
+	bool reassigned : 1;
+	bool has_tail_calls : 1;
+	bool specialized : 1;
+	bool maybe_negative : 1;
+	DataType dtype;
 	
 	union {
 		Expr *init; // vardecl
@@ -130,6 +221,7 @@ typedef struct Decl {
 	
 	union {
 		int64_t func_id; // funcdecl
+		int64_t struct_id; // structdecl
 		bool is_param; // vardecl
 	};
 	
@@ -139,11 +231,24 @@ typedef struct Decl {
 	
 	union {
 		Token **params; // funcdecl
+		Token **fields; // structdecl
 	};
 	
 	union {
 		DeclItem *enclosed; // funcdecl
 	};
+	
+	union {
+		DataType **clones; // funcdecl
+	};
+	
+	union {
+		int64_t memo_size; // funcdecl, 0 if not memoized
+	};
+	
+	union {
+		MemoPolicy memo_policy; // funcdecl
+	};
 } Decl;
 
 typedef enum {
@@ -155,6 +260,7 @@ typedef enum {
 	ST_RETURN,
 	ST_IF,
 	ST_WHILE,
+	ST_STRUCTDECL,
 } StmtType;
 
 typedef struct Stmt {
@@ -164,7 +270,7 @@ typedef struct Stmt {
 	struct Stmt *next;
 	
 	union {
-		Decl *decl; // vardecl, funcdecl
+		Decl *decl; // vardecl, funcdecl, structdecl
 		Expr *target; // assign
 		Expr *cond; // if, while
 	};
@@ -178,6 +284,8 @@ typedef struct Stmt {
 	
 	union {
 		struct Block *else_body; // if
+		bool is_tail_call; // return
+		Decl *counted_array; // while
 	};
 } Stmt;
 
@@ -126,7 +126,7 @@ static char *copy_runtime_file(char *name, unsigned char *text, int64_t size)
 	return path;
 }
 
-Project *build_project(char *filename)
+Project *build_project(char *filename, bool optimize)
 {
 	cache_dir = string_concat(getenv("HOME"), "/.crispy", 0);
 	make_dir(cache_dir);
@@ -141,11 +141,25 @@ Project *build_project(char *filename)
 	project->main = build_module(filename);
 	project->exename = string_concat(cache_dir, "/", project->main->pathid, 0);
 	
-	char *gcc_cmd = string_concat(
-		"gcc -o ", project->exename, " -std=c17 -pedantic-errors ",
-		runtime_c_path, " ", project->main->cfilename, 0
-	);
+	char *gcc_cmd = 0;
+	
+	// an optimized build compiles the runtime and the module as one translation
+	// unit, so the runtime functions can be inlined into the module code
+	if(optimize) {
+		gcc_cmd = string_concat(
+			"gcc -o ", project->exename, " -std=c17 -pedantic-errors -O2 ",
+			"-include ", runtime_c_path, " ", project->main->cfilename, 0
+		);
+	}
+	else {
+		gcc_cmd = string_concat(
+			"gcc -o ", project->exename, " -std=c17 -pedantic-errors ",
+			runtime_c_path, " ", project->main->cfilename, 0
+		);
+	}
 	
+	// the program output must not land in the middle of the compiler output
+	fflush(stdout);
 	system(gcc_cmd);
 	system(project->exename);
 	return project;
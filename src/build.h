@@ -3,6 +3,6 @@
 
 #include "ast.h"
 
-Project *build_project(char *filename);
+Project *build_project(char *filename, bool optimize);
 
 #endif
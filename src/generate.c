@@ -1,15 +1,35 @@
 #include <stdarg.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include "generate.h"
+#include "analyze.h"
+#include "print.h"
 #include "array.h"
 
 static void g_expr(Expr *expr);
+static void g_native(Expr *expr);
 static void g_stmt(Stmt *stmt);
+static void g_inline_call(Expr *call);
 static void g_block(Block *block);
+static void g_scope_ref(Scope *scope);
+static void walk_expr(
+	Expr *expr, bool (*previsitor)(Expr*), bool (*postvisitor)(Expr*)
+);
+static bool tmp_assign_previsitor(Expr *expr);
 
 static FILE *file = 0;
 static int64_t level = 0;
 static Decl *cur_funcdecl = 0;
+static int64_t template_count = 0;
+static int64_t inline_count = 0;
+static Expr *cur_inline_call = 0;
+static int64_t cur_inline_id = 0;
+static bool inline_jumps = false;
+static Decl **inline_funcs = 0;
+static int64_t cur_clone = 0;
+static Decl **fast_arrays = 0;
+static Decl **slow_arrays = 0;
 
 static void write(char *msg, ...)
 {
@@ -40,13 +60,15 @@ static void write(char *msg, ...)
 			else if(*msg == 'V') {
 				Decl *vardecl = va_arg(args, Decl*);
 				
-				write(
-					"scope%i.m_%T", vardecl->scope->scope_id, vardecl->ident
-				);
+				g_scope_ref(vardecl->scope);
+				write(".m_%T", vardecl->ident);
 			}
 			else if(*msg == 'E') {
 				g_expr(va_arg(args, Expr*));
 			}
+			else if(*msg == 'N') {
+				g_native(va_arg(args, Expr*));
+			}
 			else if(*msg == '%') {
 				fputc('%', file);
 			}
@@ -75,7 +97,8 @@ static void write(char *msg, ...)
 
 static void g_tmpvar(Expr *expr)
 {
-	write("scope%i.tmp%i", expr->scope->scope_id, expr->tmp_id);
+	g_scope_ref(expr->scope);
+	write(".tmp%i", expr->tmp_id);
 }
 
 static bool is_var_used_in_func(Decl *decl)
@@ -123,6 +146,25 @@ static int64_t enclosed_id(Decl *decl)
 	return -1;
 }
 
+static bool has_decl(Decl **decls, Decl *decl)
+{
+	array_for(decls, i) {
+		if(decls[i] == decl) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+static bool is_unchecked_item(Expr *subscript)
+{
+	return
+		subscript->type == EX_SUBSCRIPT && subscript->is_safe_index &&
+		subscript->index->dtype == DT_INT &&
+		has_decl(fast_arrays, subscript->array->decl);
+}
+
 static void g_var(Expr *var, bool no_deref)
 {
 	if(is_var_used_in_func(var->decl)) {
@@ -146,24 +188,110 @@ static void g_var(Expr *var, bool no_deref)
 
 static void g_array(Expr *array)
 {
-	write("NEW_ARRAY(%i", array->length);
+	if(array->template_id > 0) {
+		write(
+			"NEW_ARRAY_FROM(%i, array_template%i)",
+			array->length, array->template_id
+		);
+	}
+	else {
+		write("NEW_ARRAY(%i)", array->length);
+	}
+}
+
+static void g_builtin_call(Expr *call)
+{
+	static char *builtin_names[] = {
+		#define F(x, min_args, max_args) #x,
+		BUILTINS(F)
+		#undef F
+	};
 	
-	for(Expr *item = array->items; item; item = item->next) {
-		write(", %E", item);
+	static int64_t builtin_max_args[] = {
+		#define F(x, min_args, max_args) max_args,
+		BUILTINS(F)
+		#undef F
+	};
+	
+	write("builtin_%s(%i", builtin_names[call->builtin], call->start->line);
+	
+	for(Expr *arg = call->args; arg; arg = arg->next) {
+		write(", %E", arg);
+	}
+	
+	// missing optional arguments are null
+	for(
+		int64_t i = call->argcount; i < builtin_max_args[call->builtin]; i++
+	) {
+		write(", NULL_VALUE");
 	}
 	
 	write(")");
 }
 
+static void g_funcname(Decl *func, int64_t clone)
+{
+	write("%F", func);
+	
+	if(clone > 0) {
+		write("_c%i", clone);
+	}
+}
+
 static void g_call(Expr *call)
 {
-	write("call(%i, %E, %i", call->start->line, call->callee, call->argcount);
+	if(call->is_builtin) {
+		g_builtin_call(call);
+		return;
+	}
+	
+	if(call->is_direct) {
+		Decl *func = call->callee->decl;
+		g_funcname(func, call_clone(call));
+		
+		if(func->enclosed || !call->callee_declared) {
+			write(
+				"(function_enclosed(%i, %E), ", call->start->line, call->callee
+			);
+		}
+		else {
+			write("(0, ");
+		}
+	}
+	else {
+		write(
+			"call(%i, %E, %i, ",
+			call->start->line, call->callee, call->argcount
+		);
+	}
+	
+	if(call->argcount == 0) {
+		write("0)");
+		return;
+	}
+	
+	write("(Value[]){");
 	
 	for(Expr *arg = call->args; arg; arg = arg->next) {
-		write(", %E", arg);
+		write(arg == call->args ? "%E" : ", %E", arg);
 	}
 	
-	write(")");
+	write("})");
+}
+
+static void g_float(double value)
+{
+	if(isnan(value)) {
+		write("__builtin_nan(\"\")");
+	}
+	else if(isinf(value)) {
+		write(value < 0 ? "(-__builtin_inf())" : "__builtin_inf()");
+	}
+	else {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%.17g", value);
+		write(strpbrk(buf, ".e") ? "%s" : "%s.0", buf);
+	}
 }
 
 static void g_const_init_expr(Expr *expr)
@@ -178,31 +306,174 @@ static void g_const_init_expr(Expr *expr)
 		case EX_INT:
 			write("INT_VALUE_INIT(%i)", expr->value);
 			break;
+		case EX_FLOAT:
+			write("FLOAT_VALUE_INIT(");
+			g_float(expr->floatval);
+			write(")");
+			break;
 		case EX_STRING:
 			write("STRING_VALUE_INIT(\"%s\")", expr->string);
 			break;
 		default:
-			write("/* g_const_init_expr default */");
+			// constant folding leaves only literals
+			error_at(
+				expr->start, "constant initializer is not a literal"
+			);
+	}
+}
+
+static char *binop_name(Token *op)
+{
+	return
+		op->punct == '+' ? "add" :
+		op->punct == '-' ? "sub" :
+		op->punct == '*' ? "mul" :
+		op->punct == '/' ? "div" :
+		op->punct == '%' ? "mod" :
+		op->punct == '<' ? "lt" :
+		op->punct == '>' ? "gt" :
+		op->punct == IPUNCT("==") ? "eq" :
+		op->punct == IPUNCT("!=") ? "ne" :
+		op->punct == IPUNCT("<=") ? "le" :
+		op->punct == IPUNCT(">=") ? "ge" :
+		0 /* should never happen */;
+}
+
+// Expressions with a numeric static type are generated as plain C arithmetic
+// on int64_t or double instead of going through the tagged Value operators.
+
+static void g_native(Expr *expr)
+{
+	switch(expr->type) {
+		case EX_NULL:
+			write("0");
+			break;
+		case EX_BOOL:
+			write("%i", !!expr->value);
+			break;
+		case EX_INT:
+			write("INT64_C(%i)", expr->value);
+			break;
+		case EX_FLOAT:
+			g_float(expr->floatval);
+			break;
+		case EX_VAR:
+			g_var(expr, false);
+			write(expr->dtype == DT_FLOAT ? ".floatval" : ".value");
+			break;
+		case EX_BINOP:
+			if(
+				expr->dtype == DT_INT &&
+				(expr->op->punct == '/' || expr->op->punct == '%')
+			) {
+				write(
+					"int_%s(%i, %N, %N)", expr->op->punct == '/' ? "div" : "mod",
+					expr->start->line, expr->left, expr->right
+				);
+			}
+			else {
+				write("(%N %T %N)", expr->left, expr->op, expr->right);
+			}
+			
+			break;
+		case EX_UNARY:
+			write("(%T%N)", expr->op, expr->subexpr);
 			break;
 	}
 }
 
 static void g_binop(Expr *expr)
 {
-	if(expr->oplevel == OP_CMP) {
+	if(
+		expr->oplevel == OP_CMP &&
+		is_num_type(expr->left->dtype) && is_num_type(expr->right->dtype)
+	) {
+		write("BOOL_VALUE(%N)", expr);
+	}
+	else if(expr->dtype == DT_INT) {
+		write("INT_VALUE(%N)", expr);
+	}
+	else if(expr->dtype == DT_FLOAT) {
+		write("FLOAT_VALUE(%N)", expr);
+	}
+	else {
 		write(
-			"BINOP(%i, TY_BOOL, %E, %T, %E)",
-			expr->start->line, expr->left, expr->op, expr->right
+			"binop_%s(%i, %E, %E)", binop_name(expr->op),
+			expr->start->line, expr->left, expr->right
 		);
 	}
+}
+
+static void g_cond(Expr *cond)
+{
+	if(cond->type == EX_BINOP && cond->oplevel == OP_CMP) {
+		if(is_num_type(cond->left->dtype) && is_num_type(cond->right->dtype)) {
+			write("%N", cond);
+		}
+		else {
+			write(
+				"cmp_%s(%i, %E, %E)", binop_name(cond->op),
+				cond->start->line, cond->left, cond->right
+			);
+		}
+	}
+	else {
+		write("truthy(%E)", cond);
+	}
+}
+
+static void g_unary(Expr *expr)
+{
+	if(expr->dtype == DT_INT) {
+		write("INT_VALUE(%N)", expr);
+	}
+	else if(expr->dtype == DT_FLOAT) {
+		write("FLOAT_VALUE(%N)", expr);
+	}
 	else {
 		write(
-			"BINOP(%i, TY_INT, %E, %T, %E)",
-			expr->start->line, expr->left, expr->op, expr->right
+			"unary_%s(%i, %E)", expr->op->punct == '-' ? "neg" : "pos",
+			expr->start->line, expr->subexpr
 		);
 	}
 }
 
+static void g_field(Expr *field)
+{
+	if(field->structdecl) {
+		write(
+			"(*struct_field(%i, %E, &shape%i, %i))",
+			field->start->line, field->object, field->structdecl->struct_id,
+			field->offset
+		);
+	}
+	else {
+		write(
+			"(*struct_field_named(%i, %E, \"%T\"))",
+			field->start->line, field->object, field->field
+		);
+	}
+}
+
+static void g_slice(Expr *slice)
+{
+	write("slice(%i, %E, ", slice->start->line, slice->array);
+	
+	if(slice->index) {
+		write("%E, ", slice->index);
+	}
+	else {
+		write("NULL_VALUE, ");
+	}
+	
+	if(slice->stop) {
+		write("%E)", slice->stop);
+	}
+	else {
+		write("NULL_VALUE)");
+	}
+}
+
 static void g_expr_immed(Expr *expr)
 {
 	switch(expr->type) {
@@ -215,6 +486,11 @@ static void g_expr_immed(Expr *expr)
 		case EX_INT:
 			write("INT_VALUE(%i)", expr->value);
 			break;
+		case EX_FLOAT:
+			write("FLOAT_VALUE(");
+			g_float(expr->floatval);
+			write(")");
+			break;
 		case EX_STRING:
 			write("STRING_VALUE(\"%s\")", expr->string);
 			break;
@@ -231,18 +507,31 @@ static void g_expr_immed(Expr *expr)
 			g_array(expr);
 			break;
 		case EX_SUBSCRIPT:
-			write(
-				"(*subscript(%i, %E, %E))",
-				expr->start->line, expr->array, expr->index
-			);
+			if(is_unchecked_item(expr)) {
+				write("%E.array->items[%N]", expr->array, expr->index);
+			}
+			else {
+				write(
+					"subscript(%i, %E, %E)",
+					expr->start->line, expr->array, expr->index
+				);
+			}
 			
 			break;
 		case EX_UNARY:
-			write(
-				"INT_UNARY(%i, %T, %E)",
-				expr->start->line, expr->op, expr->subexpr
-			);
-			
+			g_unary(expr);
+			break;
+		case EX_MAP:
+			write("NEW_MAP()");
+			break;
+		case EX_NEW:
+			write("NEW_STRUCT(&shape%i)", expr->structdecl->struct_id);
+			break;
+		case EX_FIELD:
+			g_field(expr);
+			break;
+		case EX_SLICE:
+			g_slice(expr);
 			break;
 	}
 }
@@ -257,28 +546,290 @@ static void g_expr(Expr *expr)
 	}
 }
 
-static void g_scope(Scope *scope)
+// All block scopes of a function live in the frame struct of its body, so only
+// a function call pushes a scope frame. The slots of a nested block are a
+// struct member "sN" of the union "u" of its parent block. Sibling blocks share
+// the same slots. The largest member comes first in each union, because an
+// initializer only covers the first member of a union. The locals of functions
+// inlined into the frame are members of the union "inl" of the frame struct,
+// as only one inlined body runs at a time.
+
+static bool is_frame_scope(Scope *scope)
+{
+	Decl *func = scope->hosting_func;
+	return scope->parent == 0 || func && func->body->scope == scope;
+}
+
+static Scope *frame_scope(Scope *scope)
+{
+	while(!is_frame_scope(scope)) {
+		scope = scope->parent;
+	}
+	
+	return scope;
+}
+
+static void g_scope_ref(Scope *scope)
+{
+	if(
+		cur_inline_call &&
+		scope == cur_inline_call->callee->decl->body->scope
+	) {
+		g_scope_ref(frame_scope(cur_inline_call->scope));
+		write(".inl.s%i", scope->scope_id);
+	}
+	else if(is_frame_scope(scope)) {
+		write("scope%i", scope->scope_id);
+	}
+	else {
+		g_scope_ref(scope->parent);
+		write(".u.s%i", scope->scope_id);
+	}
+}
+
+static int64_t own_slot_count(Scope *scope)
+{
+	int64_t count = scope->tmp_count;
+	
+	for(Decl *decl = scope->decls; decl; decl = decl->next) {
+		count += !decl->isstruct;
+	}
+	
+	return count;
+}
+
+static Block **child_blocks(Block *block)
+{
+	Block **children = 0;
+	
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
+			array_push(children, stmt->body);
+			
+			if(stmt->type == ST_IF && stmt->else_body) {
+				array_push(children, stmt->else_body);
+			}
+		}
+	}
+	
+	return children;
+}
+
+static bool inline_func_postvisitor(Expr *expr)
+{
+	if(expr->type == EX_CALL && expr->is_inline) {
+		Decl *func = expr->callee->decl;
+		
+		array_for(inline_funcs, i) {
+			if(inline_funcs[i] == func) {
+				return true;
+			}
+		}
+		
+		array_push(inline_funcs, func);
+	}
+	
+	return true;
+}
+
+static void collect_inline_funcs(Block *block)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		switch(stmt->type) {
+			case ST_VARDECL:
+				if(stmt->decl->init) {
+					walk_expr(
+						stmt->decl->init,
+						tmp_assign_previsitor, inline_func_postvisitor
+					);
+				}
+				
+				break;
+			case ST_ASSIGN:
+				walk_expr(
+					stmt->target, tmp_assign_previsitor, inline_func_postvisitor
+				);
+				
+				walk_expr(
+					stmt->value, tmp_assign_previsitor, inline_func_postvisitor
+				);
+				
+				break;
+			case ST_PRINT:
+				for(Expr *value = stmt->values; value; value = value->next) {
+					walk_expr(
+						value, tmp_assign_previsitor, inline_func_postvisitor
+					);
+				}
+				
+				break;
+			case ST_CALL:
+				walk_expr(
+					stmt->call, tmp_assign_previsitor, inline_func_postvisitor
+				);
+				
+				break;
+			case ST_RETURN:
+				if(stmt->value) {
+					walk_expr(
+						stmt->value,
+						tmp_assign_previsitor, inline_func_postvisitor
+					);
+				}
+				
+				break;
+			case ST_IF:
+			case ST_WHILE:
+				walk_expr(
+					stmt->cond, tmp_assign_previsitor, inline_func_postvisitor
+				);
+				
+				collect_inline_funcs(stmt->body);
+				
+				if(stmt->type == ST_IF && stmt->else_body) {
+					collect_inline_funcs(stmt->else_body);
+				}
+				
+				break;
+		}
+	}
+}
+
+// the bodies of the functions inlined into the frame of a block
+
+static Block **inline_bodies(Block *block)
+{
+	Block **bodies = 0;
+	
+	if(!is_frame_scope(block->scope)) {
+		return 0;
+	}
+	
+	inline_funcs = 0;
+	collect_inline_funcs(block);
+	
+	array_for(inline_funcs, i) {
+		array_push(bodies, inline_funcs[i]->body);
+	}
+	
+	return bodies;
+}
+
+static int64_t max_slot_count(Block **blocks);
+
+static int64_t slot_count(Block *block)
+{
+	return
+		own_slot_count(block->scope) +
+		max_slot_count(child_blocks(block)) +
+		max_slot_count(inline_bodies(block));
+}
+
+static int64_t max_slot_count(Block **blocks)
+{
+	int64_t max_count = 0;
+	
+	array_for(blocks, i) {
+		int64_t count = slot_count(blocks[i]);
+		max_count = count > max_count ? count : max_count;
+	}
+	
+	return max_count;
+}
+
+static void g_scope_fields(Block *block);
+
+static void g_scope_union(Block **blocks, char *name)
 {
-	if(scope->decl_count == 0 && scope->tmp_count == 0) {
+	Block **members = 0;
+	
+	// largest first
+	while(true) {
+		Block *largest = 0;
+		
+		array_for(blocks, i) {
+			if(
+				blocks[i] && slot_count(blocks[i]) > 0 &&
+				(!largest || slot_count(blocks[i]) > slot_count(largest))
+			) {
+				largest = blocks[i];
+			}
+		}
+		
+		if(!largest) {
+			break;
+		}
+		
+		array_push(members, largest);
+		
+		array_for(blocks, i) {
+			if(blocks[i] == largest) {
+				blocks[i] = 0;
+			}
+		}
+	}
+	
+	if(array_length(members) == 0) {
 		return;
 	}
 	
-	write("%>struct {\n");
+	write("%>union {\n");
 	level ++;
 	
+	array_for(members, i) {
+		write("%>struct {\n");
+		level ++;
+		g_scope_fields(members[i]);
+		level --;
+		write("%>} s%i;\n", members[i]->scope->scope_id);
+	}
+	
+	level --;
+	write("%>} %s;\n", name);
+}
+
+static void g_scope_fields(Block *block)
+{
+	Scope *scope = block->scope;
+	
 	for(Decl *decl = scope->decls; decl; decl = decl->next) {
-		write("%>Value m_%s;\n", decl->ident->text);
+		if(!decl->isstruct) {
+			write("%>Value m_%s;\n", decl->ident->text);
+		}
 	}
 	
 	for(int64_t i=0; i < scope->tmp_count; i++) {
 		write("%>Value tmp%i;\n", i+1);
 	}
 	
+	g_scope_union(child_blocks(block), "u");
+	g_scope_union(inline_bodies(block), "inl");
+}
+
+static void g_scope(Block *block)
+{
+	Scope *scope = block->scope;
+	
+	if(slot_count(block) == 0) {
+		return;
+	}
+	
+	write("%>struct {\n");
+	level ++;
+	g_scope_fields(block);
 	level --;
 	write("%>} scope%i = {\n", scope->scope_id);
 	level ++;
 	
+	// a frame with only nested blocks still needs one initializer
+	bool has_inits = scope->tmp_count > 0;
+	
 	for(Decl *decl = scope->decls; decl; decl = decl->next) {
+		if(decl->isstruct) {
+			continue;
+		}
+		
+		has_inits = true;
 		write("%>");
 		
 		if(decl->init_deferred) {
@@ -303,12 +854,52 @@ static void g_scope(Scope *scope)
 		write("%>UNINITIALIZED,\n");
 	}
 	
+	if(!has_inits) {
+		write("%>0\n");
+	}
+	
 	level --;
 	write("%>};\n");
 	
+	Decl **params = 0;
+	
+	for(Decl *decl = scope->decls; decl; decl = decl->next) {
+		if(!decl->isfunc && !decl->isstruct && decl->is_param) {
+			array_push(params, decl);
+		}
+	}
+	
+	// decls are listed in reverse, but the arguments come in order
+	for(int64_t i = array_length(params) - 1; i >= 0; i--) {
+		write(
+			"%>%V = ARG_VALUE(args[%i]);\n",
+			params[i], array_length(params) - 1 - i
+		);
+	}
+}
+
+// Entering a nested or inlined block resets its variables like the initializer
+// of the frame struct does for the function body. Temporaries are always
+// assigned before they are read.
+
+static void g_scope_reset(Block *block)
+{
+	Scope *scope = block->scope;
+	
 	for(Decl *decl = scope->decls; decl; decl = decl->next) {
-		if(!decl->isfunc && decl->is_param) {
-			write("%>%V = va_arg(args, Value);\n", decl);
+		if(decl->isstruct || !decl->isfunc && decl->is_param) {
+			continue;
+		}
+		else if(decl->init_deferred || decl->isfunc) {
+			write("%>%V.type = TYX_UNINITIALIZED;\n", decl);
+		}
+		else if(decl->init) {
+			write("%>%V = (Value)", decl);
+			g_const_init_expr(decl->init);
+			write(";\n");
+		}
+		else {
+			write("%>%V = NULL_VALUE;\n", decl);
 		}
 	}
 }
@@ -316,7 +907,7 @@ static void g_scope(Scope *scope)
 static void walk_expr(
 	Expr *expr, bool (*previsitor)(Expr*), bool (*postvisitor)(Expr*)
 ) {
-	if(!previsitor(expr)) {
+	if(previsitor && !previsitor(expr)) {
 		return;
 	}
 	
@@ -331,17 +922,36 @@ static void walk_expr(
 			walk_expr(arg, previsitor, postvisitor);
 		}
 	}
-	else if(expr->type == EX_ARRAY) {
+	else if(expr->type == EX_ARRAY || expr->type == EX_MAP) {
 		for(Expr *item = expr->items; item; item = item->next) {
 			walk_expr(item, previsitor, postvisitor);
 		}
 	}
-	else if(expr->type == EX_SUBSCRIPT) {
+	else if(expr->type == EX_SUBSCRIPT) {
+		walk_expr(expr->array, previsitor, postvisitor);
+		walk_expr(expr->index, previsitor, postvisitor);
+	}
+	else if(expr->type == EX_UNARY) {
+		walk_expr(expr->subexpr, previsitor, postvisitor);
+	}
+	else if(expr->type == EX_NEW) {
+		for(Expr *arg = expr->args; arg; arg = arg->next) {
+			walk_expr(arg, previsitor, postvisitor);
+		}
+	}
+	else if(expr->type == EX_FIELD) {
+		walk_expr(expr->object, previsitor, postvisitor);
+	}
+	else if(expr->type == EX_SLICE) {
 		walk_expr(expr->array, previsitor, postvisitor);
-		walk_expr(expr->index, previsitor, postvisitor);
-	}
-	else if(expr->type == EX_UNARY) {
-		walk_expr(expr->subexpr, previsitor, postvisitor);
+		
+		if(expr->index) {
+			walk_expr(expr->index, previsitor, postvisitor);
+		}
+		
+		if(expr->stop) {
+			walk_expr(expr->stop, previsitor, postvisitor);
+		}
 	}
 	
 	postvisitor(expr);
@@ -352,14 +962,63 @@ static bool tmp_assign_previsitor(Expr *expr)
 	return expr->has_tmps;
 }
 
+static void g_map_items(Expr *map)
+{
+	for(Expr *key = map->items; key; key = key->next->next) {
+		write("%>map_set(%i, ", key->start->line);
+		g_tmpvar(map);
+		write(".map, %E, %E);\n", key, key->next);
+	}
+}
+
+static void g_array_items(Expr *array)
+{
+	int64_t index = 0;
+	
+	for(Expr *item = array->items; item; item = item->next) {
+		if(array->template_id == 0 || !item->isconst) {
+			write("%>");
+			g_tmpvar(array);
+			write(".array->items[%i] = %E;\n", index, item);
+		}
+		
+		index ++;
+	}
+}
+
+static void g_struct_fields(Expr *new)
+{
+	int64_t offset = 0;
+	
+	for(Expr *arg = new->args; arg; arg = arg->next) {
+		write("%>");
+		g_tmpvar(new);
+		write(".structure->fields[%i] = %E;\n", offset, arg);
+		offset ++;
+	}
+}
+
 static bool tmp_assign_postvisitor(Expr *expr)
 {
-	if(expr->tmp_id > 0) {
+	if(expr->type == EX_CALL && expr->is_inline) {
+		g_inline_call(expr);
+	}
+	else if(expr->tmp_id > 0) {
 		write("%>");
 		g_tmpvar(expr);
 		write(" = ");
 		g_expr_immed(expr);
 		write(";\n");
+		
+		if(expr->type == EX_ARRAY) {
+			g_array_items(expr);
+		}
+		else if(expr->type == EX_MAP) {
+			g_map_items(expr);
+		}
+		else if(expr->type == EX_NEW) {
+			g_struct_fields(expr);
+		}
 	}
 }
 
@@ -401,7 +1060,27 @@ static void g_assign(Stmt *assign)
 {
 	g_tmp_assigns(assign->target);
 	g_tmp_assigns(assign->value);
-	write("%>%E = %E;\n", assign->target, assign->value);
+	
+	if(is_unchecked_item(assign->target)) {
+		Expr *target = assign->target;
+		
+		write(
+			"%>%E.array->items[%N] = %E;\n",
+			target->array, target->index, assign->value
+		);
+	}
+	else if(assign->target->type == EX_SUBSCRIPT) {
+		Expr *target = assign->target;
+		
+		write(
+			"%>assign_subscript(%i, %E, %E, %E);\n",
+			target->start->line, target->array, target->index, assign->value
+		);
+	}
+	else {
+		write("%>%E = %E;\n", assign->target, assign->value);
+	}
+	
 	g_tmp_clears(assign->target);
 	g_tmp_clears(assign->value);
 }
@@ -428,6 +1107,80 @@ static void g_print(Stmt *print)
 	}
 }
 
+static Stmt *last_stmt(Block *block)
+{
+	Stmt *stmt = block->stmts;
+	
+	while(stmt && stmt->next) {
+		stmt = stmt->next;
+	}
+	
+	return stmt;
+}
+
+// An inlined call emits the body of the callee in place, with the arguments
+// assigned straight to its parameters in the frame of the caller. A return
+// jumps to the end of the body, unless it is the last statement anyway. The
+// body is generated with the clone of the callee for the argument types. An
+// empty frame with the name of the callee keeps it in the traceback.
+
+static void g_inline_call(Expr *call)
+{
+	Decl *func = call->callee->decl;
+	Decl *old_funcdecl = cur_funcdecl;
+	Expr *old_inline_call = cur_inline_call;
+	int64_t old_inline_id = cur_inline_id;
+	int64_t clone = call_clone(call);
+	Stmt *last = last_stmt(func->body);
+	
+	inline_count ++;
+	cur_inline_id = inline_count;
+	inline_jumps = false;
+	write("%>{\n");
+	level ++;
+	
+	if(!call->callee_declared) {
+		write(
+			"%>function_enclosed(%i, %E);\n", call->start->line, call->callee
+		);
+	}
+	
+	cur_inline_call = call;
+	Expr *arg = call->args;
+	
+	array_for(func->params, i) {
+		Decl *param = lookup(func->params[i], func->body->scope);
+		write("%>%V = %E;\n", param, arg);
+		arg = arg->next;
+	}
+	
+	write("%>PUSH_EMPTY_SCOPE(\"%s\");\n", func->ident->text);
+	level --;
+	cur_funcdecl = func;
+	specialize(func, clone);
+	g_block(func->body);
+	specialize(func, 0);
+	level ++;
+	
+	if(call->tmp_id > 0 && (!last || last->type != ST_RETURN)) {
+		write("%>");
+		g_tmpvar(call);
+		write(" = NULL_VALUE;\n");
+	}
+	
+	if(inline_jumps) {
+		write("%>inline_end%i:;\n", cur_inline_id);
+	}
+	
+	write("%>POP_SCOPE();\n");
+	level --;
+	write("%>}\n");
+	
+	cur_funcdecl = old_funcdecl;
+	cur_inline_call = old_inline_call;
+	cur_inline_id = old_inline_id;
+}
+
 static void g_funcdecl(Decl *func)
 {
 	if(func->init_deferred) {
@@ -459,17 +1212,114 @@ static void g_funcdecl(Decl *func)
 static void g_callstmt(Stmt *stmt)
 {
 	g_tmp_assigns(stmt->call);
-	write("%>%E;\n", stmt->call);
+	
+	if(!stmt->call->is_inline) {
+		write("%>%E;\n", stmt->call);
+	}
+	
 	g_tmp_clears(stmt->call);
 }
 
-static void g_return(Stmt *stmt)
+// A tail call of the enclosing function restarts it with the new arguments, so
+// the scope struct is initialized again and no C stack is used.
+
+static void g_tail_call(Expr *call)
+{
+	int64_t i = 0;
+	
+	for(Expr *arg = call->args; arg; arg = arg->next) {
+		g_tmp_assigns(arg);
+	}
+	
+	for(Expr *arg = call->args; arg; arg = arg->next, i++) {
+		write("%>tail_args[%i] = %E;\n", i, arg);
+	}
+	
+	if(call->argcount > 0) {
+		write("%>args = tail_args;\n");
+	}
+	
+	write("%>RETURN_SCOPE();\n");
+	write("%>goto tail_call;\n");
+}
+
+// whether the clone being generated restarts itself somewhere in the block, so
+// it needs the array for the new arguments and the label to jump to
+static bool has_clone_tail_calls(Block *block)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		if(stmt->type == ST_RETURN) {
+			if(stmt->is_tail_call && call_clone(stmt->value) == cur_clone) {
+				return true;
+			}
+		}
+		else if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
+			if(has_clone_tail_calls(stmt->body)) {
+				return true;
+			}
+			
+			if(
+				stmt->type == ST_IF && stmt->else_body &&
+				has_clone_tail_calls(stmt->else_body)
+			) {
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+static void g_inline_return(Stmt *stmt)
 {
 	if(stmt->value) {
 		g_tmp_assigns(stmt->value);
 	}
 	
+	if(cur_inline_call->tmp_id > 0) {
+		write("%>");
+		g_tmpvar(cur_inline_call);
+		
+		if(stmt->value) {
+			write(" = %E;\n", stmt->value);
+		}
+		else {
+			write(" = NULL_VALUE;\n");
+		}
+	}
+	else if(stmt->value) {
+		write("%>%E;\n", stmt->value);
+	}
+	
+	if(stmt != last_stmt(cur_inline_call->callee->decl->body)) {
+		write("%>goto inline_end%i;\n", cur_inline_id);
+		inline_jumps = true;
+	}
+}
+
+static void g_return(Stmt *stmt)
+{
+	if(cur_inline_call) {
+		g_inline_return(stmt);
+		return;
+	}
+	else if(stmt->is_tail_call && call_clone(stmt->value) == cur_clone) {
+		g_tail_call(stmt->value);
+		return;
+	}
+	
 	if(stmt->value) {
+		g_tmp_assigns(stmt->value);
+	}
+	
+	if(cur_funcdecl->memo_size > 0) {
+		write(
+			"%>RETURN(memo_store(&memo%i, memo_args, %E));\n",
+			cur_funcdecl->func_id,
+			stmt->value ? stmt->value : &(Expr){.type = EX_NULL}
+		);
+	}
+	else if(stmt->value) {
 		write("%>RETURN(%E);\n", stmt->value);
 	}
 	else {
@@ -477,10 +1327,37 @@ static void g_return(Stmt *stmt)
 	}
 }
 
+// An if with a literal condition only emits the branch that is taken.
+
+static void g_const_if(Stmt *ifstmt)
+{
+	Expr *cond = ifstmt->cond;
+	bool taken = cond->type == EX_FLOAT ? cond->floatval != 0 : cond->value;
+	Block *block = taken ? ifstmt->body : ifstmt->else_body;
+	
+	if(block) {
+		write("%>{\n");
+		g_block(block);
+		write("%>}\n");
+	}
+}
+
 static void g_if(Stmt *ifstmt)
 {
+	Expr *cond = ifstmt->cond;
+	
+	if(
+		cond->type == EX_NULL || cond->type == EX_BOOL ||
+		cond->type == EX_INT || cond->type == EX_FLOAT
+	) {
+		g_const_if(ifstmt);
+		return;
+	}
+	
 	g_tmp_assigns(ifstmt->cond);
-	write("%>if(truthy(%E)) {\n", ifstmt->cond);
+	write("%>if(");
+	g_cond(ifstmt->cond);
+	write(") {\n");
 	
 	level ++;
 	g_tmp_clears(ifstmt->cond);
@@ -502,10 +1379,12 @@ static void g_if(Stmt *ifstmt)
 	write("%>}\n");
 }
 
-static void g_while(Stmt *whilestmt)
+static void g_while_loop(Stmt *whilestmt)
 {
 	g_tmp_assigns(whilestmt->cond);
-	write("%>while(truthy(%E)) {\n", whilestmt->cond);
+	write("%>while(");
+	g_cond(whilestmt->cond);
+	write(") {\n");
 	
 	level ++;
 	g_tmp_clears(whilestmt->cond);
@@ -519,6 +1398,44 @@ static void g_while(Stmt *whilestmt)
 	g_tmp_clears(whilestmt->cond);
 }
 
+// A loop counting up to the length of an array is generated twice, once with
+// unchecked item accesses for a plain array and once for everything else.
+
+static void g_while(Stmt *whilestmt)
+{
+	Decl *array = whilestmt->counted_array;
+	
+	if(
+		!array || has_decl(fast_arrays, array) || has_decl(slow_arrays, array)
+	) {
+		g_while_loop(whilestmt);
+		return;
+	}
+	
+	Expr *cond = whilestmt->cond;
+	Expr *counter = cond->op->punct == '>' ? cond->right : cond->left;
+	Expr *length = cond->op->punct == '>' ? cond->left : cond->right;
+	
+	if(counter->dtype != DT_INT) {
+		g_while_loop(whilestmt);
+		return;
+	}
+	
+	write("%>if(%E.type == TY_ARRAY) {\n", length->args);
+	level ++;
+	array_push(fast_arrays, array);
+	g_while_loop(whilestmt);
+	array_resize(fast_arrays, array_length(fast_arrays) - 1);
+	level --;
+	write("%>}\n%>else {\n");
+	level ++;
+	array_push(slow_arrays, array);
+	g_while_loop(whilestmt);
+	array_resize(slow_arrays, array_length(slow_arrays) - 1);
+	level --;
+	write("%>}\n");
+}
+
 static void g_stmt(Stmt *stmt)
 {
 	switch(stmt->type) {
@@ -553,8 +1470,22 @@ static void g_block(Block *block)
 {
 	level ++;
 	
+	if(
+		!is_frame_scope(block->scope) ||
+		cur_inline_call && block == cur_inline_call->callee->decl->body
+	) {
+		g_scope_reset(block);
+		
+		for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+			g_stmt(stmt);
+		}
+		
+		level --;
+		return;
+	}
+	
 	if(block->scope->parent) {
-		g_scope(block->scope);
+		g_scope(block);
 	}
 	
 	Decl *hosting_func = block->scope->hosting_func;
@@ -567,7 +1498,7 @@ static void g_block(Block *block)
 		func_name = "<main>";
 	}
 	
-	if(block->scope->decl_count > 0 || block->scope->tmp_count > 0) {
+	if(slot_count(block) > 0) {
 		write("%>PUSH_SCOPE(scope%i, ", block->scope->scope_id);
 	}
 	else {
@@ -593,9 +1524,148 @@ static void g_block(Block *block)
 	level --;
 }
 
+static void g_shapes(Block *block)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		if(stmt->type == ST_STRUCTDECL) {
+			Decl *decl = stmt->decl;
+			Token **fields = decl->fields;
+			
+			write(
+				"static Shape shape%i = {\"%T\", %i, (char*[]){",
+				decl->struct_id, decl->ident, array_length(fields)
+			);
+			
+			array_for(fields, i) {
+				write(i > 0 ? ", \"%T\"" : "\"%T\"", fields[i]);
+			}
+			
+			write("}};\n");
+		}
+		else if(stmt->type == ST_FUNCDECL) {
+			g_shapes(stmt->decl->body);
+		}
+		else if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
+			g_shapes(stmt->body);
+			
+			if(stmt->type == ST_IF && stmt->else_body) {
+				g_shapes(stmt->else_body);
+			}
+		}
+	}
+}
+
+// constant items of array literals are copied from static templates
+static bool template_postvisitor(Expr *expr)
+{
+	if(expr->type != EX_ARRAY) {
+		return true;
+	}
+	
+	bool has_consts = false;
+	
+	for(Expr *item = expr->items; item; item = item->next) {
+		has_consts = has_consts || item->isconst;
+	}
+	
+	if(!has_consts) {
+		return true;
+	}
+	
+	template_count ++;
+	expr->template_id = template_count;
+	write("static const Value array_template%i[] = {", template_count);
+	
+	for(Expr *item = expr->items; item; item = item->next) {
+		if(item != expr->items) {
+			write(", ");
+		}
+		
+		if(item->isconst) {
+			g_const_init_expr(item);
+		}
+		else {
+			write("NULL_VALUE_INIT");
+		}
+	}
+	
+	write("};\n");
+	return true;
+}
+
+static void g_expr_templates(Expr *expr)
+{
+	walk_expr(expr, 0, template_postvisitor);
+}
+
+static void g_templates(Block *block)
+{
+	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
+		switch(stmt->type) {
+			case ST_VARDECL:
+				if(stmt->decl->init) {
+					g_expr_templates(stmt->decl->init);
+				}
+				
+				break;
+			case ST_ASSIGN:
+				g_expr_templates(stmt->target);
+				g_expr_templates(stmt->value);
+				break;
+			case ST_PRINT:
+				for(Expr *value = stmt->values; value; value = value->next) {
+					g_expr_templates(value);
+				}
+				
+				break;
+			case ST_FUNCDECL:
+				g_templates(stmt->decl->body);
+				break;
+			case ST_CALL:
+				g_expr_templates(stmt->call);
+				break;
+			case ST_RETURN:
+				if(stmt->value) {
+					g_expr_templates(stmt->value);
+				}
+				
+				break;
+			case ST_IF:
+			case ST_WHILE:
+				g_expr_templates(stmt->cond);
+				g_templates(stmt->body);
+				
+				if(stmt->type == ST_IF && stmt->else_body) {
+					g_templates(stmt->else_body);
+				}
+				
+				break;
+		}
+	}
+}
+
 static void g_funcproto(Decl *funcdecl)
 {
-	write("Value %F(Value *enclosed, va_list args);\n", funcdecl);
+	for(int64_t i=0; i <= array_length(funcdecl->clones); i++) {
+		write("Value ");
+		g_funcname(funcdecl, i);
+		write("(Value *enclosed, Value *args);\n");
+	}
+	
+	if(funcdecl->memo_size > 0) {
+		static char *policies[] = {
+			#define F(x, runtime_name) #runtime_name,
+			MEMO_POLICIES(F)
+			#undef F
+		};
+		
+		write(
+			"static Memo memo%i = "
+			"{.arity = %i, .capacity = %i, .policy = %s};\n",
+			funcdecl->func_id, array_length(funcdecl->params),
+			funcdecl->memo_size, policies[funcdecl->memo_policy]
+		);
+	}
 }
 
 static void g_funcprotos(Block *block)
@@ -605,31 +1675,84 @@ static void g_funcprotos(Block *block)
 			g_funcproto(stmt->decl);
 			g_funcprotos(stmt->decl->body);
 		}
-		else if(stmt->type == ST_IF) {
+		else if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
 			g_funcprotos(stmt->body);
+			
+			if(stmt->type == ST_IF && stmt->else_body) {
+				g_funcprotos(stmt->else_body);
+			}
 		}
 	}
 }
 
-static void g_funcimpl(Decl *funcdecl)
+static void g_funcimpl(Decl *funcdecl, int64_t clone)
 {
 	cur_funcdecl = funcdecl;
-	write("Value %F(Value *enclosed, va_list args) {\n", funcdecl);
+	cur_inline_call = 0;
+	cur_clone = clone;
+	write("Value ");
+	g_funcname(funcdecl, clone);
+	write("(Value *enclosed, Value *args) {\n");
+	
+	if(funcdecl->memo_size > 0) {
+		write("\t""Value *memo_args = args;\n");
+		write(
+			"\t""Value *memo_result = memo_find(&memo%i, args);\n",
+			funcdecl->func_id
+		);
+		
+		write("\t""if(memo_result) {\n");
+		write("\t\t""return *memo_result;\n");
+		write("\t""}\n");
+	}
+	
+	if(funcdecl->has_tail_calls && has_clone_tail_calls(funcdecl->body)) {
+		int64_t param_count = array_length(funcdecl->params);
+		
+		if(param_count > 0) {
+			write("\t""Value tail_args[%i];\n", param_count);
+		}
+		
+		write("\t""tail_call:;\n");
+	}
+	
 	g_block(funcdecl->body);
-	write("\t""return NULL_VALUE;\n");
+	
+	if(funcdecl->memo_size > 0) {
+		write(
+			"\t""return memo_store(&memo%i, memo_args, NULL_VALUE);\n",
+			funcdecl->func_id
+		);
+	}
+	else {
+		write("\t""return NULL_VALUE;\n");
+	}
 	write("}\n");
 	cur_funcdecl = 0;
+	cur_clone = 0;
 }
 
 static void g_funcimpls(Block *block)
 {
 	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) {
 		if(stmt->type == ST_FUNCDECL) {
-			g_funcimpl(stmt->decl);
-			g_funcimpls(stmt->decl->body);
+			Decl *func = stmt->decl;
+			g_funcimpl(func, 0);
+			
+			for(int64_t i=1; i <= array_length(func->clones); i++) {
+				specialize(func, i);
+				g_funcimpl(func, i);
+				specialize(func, 0);
+			}
+			
+			g_funcimpls(func->body);
 		}
-		else if(stmt->type == ST_IF) {
+		else if(stmt->type == ST_IF || stmt->type == ST_WHILE) {
 			g_funcimpls(stmt->body);
+			
+			if(stmt->type == ST_IF && stmt->else_body) {
+				g_funcimpls(stmt->else_body);
+			}
 		}
 	}
 }
@@ -638,11 +1761,17 @@ void generate(Module *module)
 {
 	file = fopen(module->cfilename, "w");
 	level = 0;
+	template_count = 0;
+	inline_count = 0;
 	write("#include \"runtime.h\"\n");
+	write("// struct shapes:\n");
+	g_shapes(module->body);
+	write("// array templates:\n");
+	g_templates(module->body);
 	write("// function prototypes:\n");
 	g_funcprotos(module->body);
 	write("// global scope:\n");
-	g_scope(module->body->scope);
+	g_scope(module->body);
 	write("// function implementations:\n");
 	g_funcimpls(module->body);
 	write("// main function:\n");
@@ -123,11 +123,40 @@ void lex(Module *module)
 					value += *src - '0';
 					src ++;
 				}
+				
+				if(src[0] == '.' && isdigit(src[1])) {
+					src ++;
+					token.type = TK_FLOAT;
+					
+					while(isdigit(*src)) {
+						src ++;
+					}
+				}
+				
+				if(
+					(src[0] == 'e' || src[0] == 'E') && (
+						isdigit(src[1]) ||
+						(src[1] == '+' || src[1] == '-') && isdigit(src[2])
+					)
+				) {
+					src += 2;
+					token.type = TK_FLOAT;
+					
+					while(isdigit(*src)) {
+						src ++;
+					}
+				}
 			}
 			
-			token.type = TK_INT;
 			token.length = src - token.start;
-			token.value = value;
+			
+			if(token.type == TK_FLOAT) {
+				token.floatval = strtod(token.start, 0);
+			}
+			else {
+				token.type = TK_INT;
+				token.value = value;
+			}
 		}
 		else if(*src == '"') {
 			src ++;
@@ -176,7 +205,8 @@ void lex(Module *module)
 			*src == ';' || *src == '=' || *src == '(' || *src == ')' ||
 			*src == '{' || *src == '}' || *src == '+' || *src == '-' ||
 			*src == '[' || *src == ']' || *src == '*' || *src == '%' ||
-			*src == '<' || *src == '>' || *src == ','
+			*src == '<' || *src == '>' || *src == ',' || *src == ':' ||
+			*src == '.' || *src == '/'
 		) {
 			token.type = TK_PUNCT;
 			token.length = 1;
@@ -12,11 +12,13 @@ static void error(char *msg)
 
 int main(int argc, char **argv)
 {
-	if(argc < 2) {
+	bool optimize = argc > 1 && strcmp(argv[1], "-O") == 0;
+	
+	if(argc < 2 + optimize) {
 		error("not enough arguments");
 	}
 	
-	char *filename = argv[1];
-	build_project(filename);
+	char *filename = argv[1 + optimize];
+	build_project(filename, optimize);
 	return 0;
 }
@@ -6,6 +6,8 @@
 #include "print.h"
 #include "array.h"
 
+#define MEMO_DEFAULT_SIZE  4096
+
 static Stmt *p_stmts();
 static Block *p_block(Token **params);
 static Expr *p_expr();
@@ -13,6 +15,7 @@ static Expr *p_expr();
 static Token *cur = 0;
 static Scope *cur_scope = 0;
 static int next_func_id = 0;
+static int next_struct_id = 0;
 static int next_scope_id = 0;
 
 static void error(char *msg, ...)
@@ -64,7 +67,11 @@ static bool declare(Decl *decl)
 	decl->next = cur_scope->decls;
 	decl->scope = cur_scope;
 	cur_scope->decls = decl;
-	cur_scope->decl_count ++;
+	
+	if(!decl->isstruct) {
+		cur_scope->decl_count ++;
+	}
+	
 	return true;
 }
 
@@ -146,6 +153,66 @@ static Expr *p_array()
 	return expr;
 }
 
+static Expr *p_map()
+{
+	Token *start = eat_punct("{");
+	
+	if(!start) {
+		return 0;
+	}
+	
+	Expr *first = 0;
+	Expr *last = 0;
+	int64_t length = 0;
+	
+	while(!see_punct("}")) {
+		if(length > 0 && !eat_punct(",")) {
+			error_after("expected ',' or '}' after map item");
+		}
+		
+		Expr *key = p_expr();
+		
+		if(!key) {
+			if(length > 0) {
+				error_after("expected another map key after ','");
+			}
+			
+			error_after("expected map key or '}'");
+		}
+		
+		if(!eat_punct(":")) {
+			error_after("expected ':' after map key");
+		}
+		
+		Expr *value = p_expr();
+		
+		if(!value) {
+			error_after("expected map value after ':'");
+		}
+		
+		if(first) {
+			last->next = key;
+		}
+		else {
+			first = key;
+		}
+		
+		key->next = value;
+		last = value;
+		length ++;
+	}
+	
+	eat_punct("}");
+	
+	Expr *expr = calloc(1, sizeof(Expr));
+	expr->type = EX_MAP;
+	expr->start = start;
+	expr->scope = cur_scope;
+	expr->items = first;
+	expr->length = length;
+	return expr;
+}
+
 static Expr *p_atom()
 {
 	Expr *array = p_array();
@@ -154,10 +221,17 @@ static Expr *p_atom()
 		return array;
 	}
 	
+	Expr *map = p_map();
+	
+	if(map) {
+		return map;
+	}
+	
 	Token *token;
 	
 	(token = eat_token(TK_IDENT)) ||
 	(token = eat_token(TK_INT)) ||
+	(token = eat_token(TK_FLOAT)) ||
 	(token = eat_token(TK_STRING)) ||
 	(token = eat_keyword(KW_true)) ||
 	(token = eat_keyword(KW_false)) ||
@@ -177,6 +251,11 @@ static Expr *p_atom()
 			expr->isconst = true;
 			expr->value = token->value;
 			break;
+		case TK_FLOAT:
+			expr->type = EX_FLOAT;
+			expr->isconst = true;
+			expr->floatval = token->floatval;
+			break;
 		case TK_STRING:
 			expr->type = EX_STRING;
 			expr->isconst = true;
@@ -241,10 +320,32 @@ static Expr *p_callexpr_x(Expr *callee)
 	return expr;
 }
 
+static Expr *p_slice_x(Expr *array, Expr *index)
+{
+	Expr *stop = p_expr();
+	
+	if(!eat_punct("]")) {
+		error_after("expected ']' after slice");
+	}
+	
+	Expr *expr = calloc(1, sizeof(Expr));
+	expr->type = EX_SLICE;
+	expr->start = array->start;
+	expr->scope = cur_scope;
+	expr->array = array;
+	expr->index = index;
+	expr->stop = stop;
+	return expr;
+}
+
 static Expr *p_subscript_x(Expr *array)
 {
 	Expr *index = p_expr();
 	
+	if(eat_punct(":")) {
+		return p_slice_x(array, index);
+	}
+	
 	if(!index) {
 		error_after("expected index expression in []");
 	}
@@ -263,6 +364,24 @@ static Expr *p_subscript_x(Expr *array)
 	return expr;
 }
 
+static Expr *p_field_x(Expr *object)
+{
+	Token *field = eat_token(TK_IDENT);
+	
+	if(!field) {
+		error_after("expected field name after '.'");
+	}
+	
+	Expr *expr = calloc(1, sizeof(Expr));
+	expr->type = EX_FIELD;
+	expr->islvalue = true;
+	expr->start = object->start;
+	expr->scope = cur_scope;
+	expr->object = object;
+	expr->field = field;
+	return expr;
+}
+
 static Expr *p_postfix()
 {
 	Expr *expr = p_atom();
@@ -271,13 +390,16 @@ static Expr *p_postfix()
 		return 0;
 	}
 	
-	while(see_punct("(") || see_punct("[")) {
+	while(see_punct("(") || see_punct("[") || see_punct(".")) {
 		if(eat_punct("(")) {
 			expr = p_callexpr_x(expr);
 		}
 		else if(eat_punct("[")) {
 			expr = p_subscript_x(expr);
 		}
+		else if(eat_punct(".")) {
+			expr = p_field_x(expr);
+		}
 	}
 	
 	return expr;
@@ -329,6 +451,7 @@ static Token *p_operator(int level)
 			break;
 		case OP_MUL:
 			(op = eat_punct("*")) ||
+			(op = eat_punct("/")) ||
 			(op = eat_punct("%")) ;
 			break;
 	}
@@ -367,6 +490,11 @@ static Expr *p_binop(int level)
 			error_at(at, "arrays can not be used with %T", op);
 		}
 		
+		if(left->type == EX_MAP || right->type == EX_MAP) {
+			Token *at = left->type == EX_MAP ? left->start : right->start;
+			error_at(at, "maps can not be used with %T", op);
+		}
+		
 		if(
 			level == OP_CMP &&
 			left->type == EX_BINOP && left->oplevel == OP_CMP
@@ -537,9 +665,61 @@ static Stmt *p_print()
 	return stmt;
 }
 
+static MemoPolicy p_memo_policy()
+{
+	static char *policies[] = {
+		#define F(x, runtime_name) #x,
+		MEMO_POLICIES(F)
+		#undef F
+	};
+	
+	if(cur->type == TK_IDENT) {
+		for(int i=0; i < MEMO_POLICY_COUNT; i++) {
+			if(strcmp(policies[i], cur->id) == 0) {
+				cur ++;
+				return i;
+			}
+		}
+	}
+	
+	error("expected memo eviction policy 'lru', 'fifo' or 'keep'");
+	return MP_lru;
+}
+
 static Stmt *p_funcdecl()
 {
-	Token *start = eat_keyword(KW_function);
+	Token *start = eat_keyword(KW_memo);
+	int64_t memo_size = 0;
+	MemoPolicy memo_policy = MP_lru;
+	
+	if(start) {
+		memo_size = MEMO_DEFAULT_SIZE;
+		
+		if(eat_punct("(")) {
+			Token *size = eat_token(TK_INT);
+			
+			if(size == 0 || size->value <= 0) {
+				error("expected a positive memo table size");
+			}
+			
+			memo_size = size->value;
+			
+			if(eat_punct(",")) {
+				memo_policy = p_memo_policy();
+			}
+			
+			if(!eat_punct(")")) {
+				error_after("expected ')' after memo table size");
+			}
+		}
+		
+		if(!eat_keyword(KW_function)) {
+			error("expected 'function' after 'memo'");
+		}
+	}
+	else {
+		start = eat_keyword(KW_function);
+	}
 	
 	if(!start) {
 		return 0;
@@ -596,6 +776,8 @@ static Stmt *p_funcdecl()
 	decl->body = body;
 	decl->func_id = func_id;
 	decl->params = params;
+	decl->memo_size = memo_size;
+	decl->memo_policy = memo_policy;
 	
 	Stmt *stmt = calloc(1, sizeof(Stmt));
 	stmt->type = ST_FUNCDECL;
@@ -610,6 +792,73 @@ static Stmt *p_funcdecl()
 	return stmt;
 }
 
+static Stmt *p_structdecl()
+{
+	Token *start = eat_keyword(KW_struct);
+	
+	if(!start) {
+		return 0;
+	}
+	
+	Token *ident = eat_token(TK_IDENT);
+	
+	if(ident == 0) {
+		error("expected struct identifier");
+	}
+	
+	if(!eat_punct("{")) {
+		error_after("expected '{' after struct name");
+	}
+	
+	Token **fields = 0;
+	Token *field = eat_token(TK_IDENT);
+	
+	if(field == 0) {
+		error("expected at least one field name");
+	}
+	
+	array_push(fields, field);
+	
+	while(eat_punct(",")) {
+		Token *field = eat_token(TK_IDENT);
+		
+		if(field == 0) {
+			error_after("expected another field name after ','");
+		}
+		
+		array_for(fields, i) {
+			if(fields[i]->id == field->id) {
+				error_at(field, "field %T already declared", field);
+			}
+		}
+		
+		array_push(fields, field);
+	}
+	
+	if(!eat_punct("}")) {
+		error_after("expected '}' after field names");
+	}
+	
+	Decl *decl = calloc(1, sizeof(Decl));
+	decl->ident = ident;
+	decl->end = cur;
+	decl->isstruct = true;
+	decl->struct_id = next_struct_id ++;
+	decl->fields = fields;
+	
+	Stmt *stmt = calloc(1, sizeof(Stmt));
+	stmt->type = ST_STRUCTDECL;
+	stmt->start = start;
+	stmt->end = cur;
+	stmt->decl = decl;
+	
+	if(!declare(decl)) {
+		error_at(ident, "name %T already declared", ident);
+	}
+	
+	return stmt;
+}
+
 static Stmt *p_return()
 {
 	Token *start = eat_keyword(KW_return);
@@ -722,6 +971,7 @@ static Stmt *p_stmt()
 	(stmt = p_vardecl()) ||
 	(stmt = p_print()) ||
 	(stmt = p_funcdecl()) ||
+	(stmt = p_structdecl()) ||
 	(stmt = p_return()) ||
 	(stmt = p_if()) ||
 	(stmt = p_while()) ||
@@ -790,6 +1040,7 @@ void parse(Module *module)
 	cur = module->tokens;
 	cur_scope = 0;
 	next_func_id = 0;
+	next_struct_id = 0;
 	next_scope_id = 0;
 	Block *block = p_block(0);
 	
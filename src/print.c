@@ -20,6 +20,9 @@ void vfprint(FILE *fs, char *msg, va_list args)
 			if(*msg == 'i') {
 				fprintf(fs, "%" PRId64, va_arg(args, int64_t));
 			}
+			else if(*msg == 'f') {
+				fprintf(fs, "%g", va_arg(args, double));
+			}
 			else if(*msg == 'c') {
 				fputc(va_arg(args, int), fs);
 			}
@@ -46,6 +49,9 @@ void vfprint(FILE *fs, char *msg, va_list args)
 			else if(*msg == 'I') {
 				fprint(fs, P_COL_LITERAL "%i" P_RESET, va_arg(args, int64_t));
 			}
+			else if(*msg == 'F') {
+				fprint(fs, P_COL_LITERAL "%f" P_RESET, va_arg(args, double));
+			}
 			else if(*msg == 'T') {
 				Token *token = va_arg(args, Token*);
 				
@@ -55,7 +61,10 @@ void vfprint(FILE *fs, char *msg, va_list args)
 				else if(token->type == TK_IDENT) {
 					fprint(fs, P_COL_IDENT "%t" P_RESET, token);
 				}
-				else if(token->type == TK_INT || token->type == TK_STRING) {
+				else if(
+					token->type == TK_INT || token->type == TK_FLOAT ||
+					token->type == TK_STRING
+				) {
 					fprint(fs, P_COL_LITERAL "%t" P_RESET, token);
 				}
 				else {
@@ -177,6 +186,9 @@ void print_token(Token *token)
 		case TK_INT:
 			print("INT     ");
 			break;
+		case TK_FLOAT:
+			print("FLOAT   ");
+			break;
 		case TK_STRING:
 			print("STRING  ");
 			break;
@@ -248,6 +260,23 @@ static void print_array(Expr *array)
 	print("]");
 }
 
+static void print_map(Expr *map)
+{
+	print("{");
+	
+	for(Expr *key = map->items; key; key = key->next->next) {
+		if(key != map->items) {
+			print(", ");
+		}
+		
+		print_expr(key);
+		print(": ");
+		print_expr(key->next);
+	}
+	
+	print("}");
+}
+
 static void print_subscript(Expr *subscript)
 {
 	print_expr(subscript->array);
@@ -256,6 +285,24 @@ static void print_subscript(Expr *subscript)
 	print("]");
 }
 
+static void print_slice(Expr *slice)
+{
+	print_expr(slice->array);
+	print("[");
+	
+	if(slice->index) {
+		print_expr(slice->index);
+	}
+	
+	print(":");
+	
+	if(slice->stop) {
+		print_expr(slice->stop);
+	}
+	
+	print("]");
+}
+
 static void print_expr(Expr *expr)
 {
 	switch(expr->type) {
@@ -268,6 +315,9 @@ static void print_expr(Expr *expr)
 		case EX_INT:
 			print("%I", expr->value);
 			break;
+		case EX_FLOAT:
+			print("%F", expr->floatval);
+			break;
 		case EX_STRING:
 			print("%T", expr->start);
 			break;
@@ -292,6 +342,19 @@ static void print_expr(Expr *expr)
 			print("%T ", expr->op);
 			print_expr(expr->subexpr);
 			break;
+		case EX_MAP:
+			print_map(expr);
+			break;
+		case EX_NEW:
+			print_callexpr(expr);
+			break;
+		case EX_FIELD:
+			print_expr(expr->object);
+			print(".%T", expr->field);
+			break;
+		case EX_SLICE:
+			print_slice(expr);
+			break;
 	}
 }
 
@@ -367,6 +430,22 @@ static void print_funcdecl(Decl *funcdecl)
 	print("%>}\n");
 }
 
+static void print_structdecl(Decl *structdecl)
+{
+	print("%>%K %T { ", "struct", structdecl->ident);
+	Token **fields = structdecl->fields;
+	
+	array_for(fields, i) {
+		if(i > 0) {
+			print(", ");
+		}
+		
+		print("%T", fields[i]);
+	}
+	
+	print(" }\n");
+}
+
 static void print_call(Stmt *call)
 {
 	print("%>");
@@ -442,6 +521,9 @@ static void print_stmt(Stmt *stmt)
 		case ST_WHILE:
 			print_while(stmt);
 			break;
+		case ST_STRUCTDECL:
+			print_structdecl(stmt->decl);
+			break;
 	}
 }
 
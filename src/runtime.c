@@ -1,7 +1,17 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "runtime.h"
 
+#define MAP_GROUP_WIDTH  8
+#define MAP_EMPTY        0x80
+#define MAP_DELETED      0xfe
+#define MAP_LSBS         0x0101010101010101u
+#define MAP_MSBS         0x8080808080808080u
+#define MEMO_WAYS        4
+
 typedef struct PrintFrame {
 	struct PrintFrame *parent;
 	Value value;
@@ -9,15 +19,17 @@ typedef struct PrintFrame {
 
 static void print_value(Value value);
 static void value_decref(Value value);
+static void gc_mark(Value value);
 
 ScopeFrame *cur_scope_frame = 0;
 
 static PrintFrame *cur_print_frame = 0;
 static MemBlock *first_block = 0;
 static MemBlock *last_block = 0;
+static Memo *first_memo = 0;
 static int64_t block_count = 0;
 
-static Value *error(int64_t cur_line, char *msg, ...)
+COLD static Value *error(int64_t cur_line, char *msg, ...)
 {
 	va_list args;
 	va_start(args, msg);
@@ -35,13 +47,9 @@ static Value *error(int64_t cur_line, char *msg, ...)
 	return &NULL_VALUE;
 }
 
-Value *check_var(int64_t cur_line, Value *var, char *name)
+Value *var_undefined(int64_t cur_line, char *name)
 {
-	if(var->type == TYX_UNINITIALIZED) {
-		error(cur_line, "name %s is not defined", name);
-	}
-	
-	return var;
+	return error(cur_line, "name %s is not defined", name);
 }
 
 static void print_repr(Value value)
@@ -101,6 +109,213 @@ static void print_array(Array *array)
 	printf("]");
 }
 
+static void print_slice(Slice *slice)
+{
+	Value parent = slice->parent;
+	int64_t end = slice->offset + slice->length;
+	
+	if(parent.type == TY_ARRAY && parent.array->length < end) {
+		end = parent.array->length;
+	}
+	else if(parent.type == TY_INTARRAY && parent.intarray->length < end) {
+		end = parent.intarray->length;
+	}
+	
+	printf("[");
+	
+	for(int64_t i = slice->offset; i < end; i++) {
+		if(i > slice->offset) {
+			printf(", ");
+		}
+		
+		if(parent.type == TY_INTARRAY) {
+			printf("%li", intarray_get(parent.intarray, i));
+		}
+		else {
+			print_repr(parent.array->items[i]);
+		}
+	}
+	
+	printf("]");
+}
+
+static void print_deque(Deque *deque)
+{
+	for(
+		PrintFrame *frame = cur_print_frame->parent;
+		frame; frame = frame->parent
+	) {
+		if(frame->value.type == TY_DEQUE && frame->value.deque == deque) {
+			printf("<deque [...]>");
+			return;
+		}
+	}
+	
+	printf("<deque [");
+	
+	for(int64_t i=0; i < deque->length; i++) {
+		if(i > 0) {
+			printf(", ");
+		}
+		
+		print_repr(deque->items[(deque->head + i) & (deque->capacity - 1)]);
+	}
+	
+	printf("]>");
+}
+
+static void print_pqueue(PQueue *queue)
+{
+	printf("<pqueue of %li items>", queue->length);
+}
+
+static void print_bitset(Bitset *bitset)
+{
+	printf("<bitset [");
+	
+	for(int64_t i=0, count=0; i < bitset->length; i++) {
+		if(bitset->words[i / 64] >> i % 64 & 1) {
+			printf(count > 0 ? ", %li" : "%li", i);
+			count ++;
+		}
+	}
+	
+	printf("]>");
+}
+
+static void print_map(Map *map)
+{
+	for(
+		PrintFrame *frame = cur_print_frame->parent;
+		frame; frame = frame->parent
+	) {
+		if(frame->value.type == TY_MAP && frame->value.map == map) {
+			printf("{...}");
+			return;
+		}
+	}
+	
+	printf("{");
+	
+	for(int64_t i=0, count=0; i < map->capacity; i++) {
+		if(map->ctrl[i] < MAP_EMPTY) {
+			if(count > 0) {
+				printf(", ");
+			}
+			
+			print_repr(map->entries[i].key);
+			printf(": ");
+			print_repr(map->entries[i].value);
+			count ++;
+		}
+	}
+	
+	printf("}");
+}
+
+static void print_omap_node(OMapNode *node, int64_t *count)
+{
+	for(int64_t i=0; i <= node->count; i++) {
+		if(!node->leaf) {
+			print_omap_node(node->children[i], count);
+		}
+		
+		if(i < node->count) {
+			if(*count > 0) {
+				printf(", ");
+			}
+			
+			printf("%li: ", node->keys[i]);
+			print_repr(node->values[i]);
+			(*count) ++;
+		}
+	}
+}
+
+static void print_omap(OMap *map)
+{
+	for(
+		PrintFrame *frame = cur_print_frame->parent;
+		frame; frame = frame->parent
+	) {
+		if(frame->value.type == TY_OMAP && frame->value.omap == map) {
+			printf("<omap {...}>");
+			return;
+		}
+	}
+	
+	int64_t count = 0;
+	printf("<omap {");
+	
+	if(map->root) {
+		print_omap_node(map->root, &count);
+	}
+	
+	printf("}>");
+}
+
+static void print_struct(Struct *structure)
+{
+	for(
+		PrintFrame *frame = cur_print_frame->parent;
+		frame; frame = frame->parent
+	) {
+		if(
+			frame->value.type == TY_STRUCT &&
+			frame->value.structure == structure
+		) {
+			printf("%s(...)", structure->shape->name);
+			return;
+		}
+	}
+	
+	printf("%s(", structure->shape->name);
+	
+	for(int64_t i=0; i < structure->shape->field_count; i++) {
+		if(i > 0) {
+			printf(", ");
+		}
+		
+		print_repr(structure->fields[i]);
+	}
+	
+	printf(")");
+}
+
+static void print_float(double value)
+{
+	char buf[32];
+	
+	for(int precision = 15; precision <= 17; precision ++) {
+		snprintf(buf, sizeof(buf), "%.*g", precision, value);
+		
+		if(strtod(buf, 0) == value) {
+			break;
+		}
+	}
+	
+	if(!strpbrk(buf, ".ein")) {
+		strcat(buf, ".0");
+	}
+	
+	printf("%s", buf);
+}
+
+static void print_intarray(IntArray *array)
+{
+	printf("[");
+	
+	for(int64_t i=0; i < array->length; i++) {
+		if(i > 0) {
+			printf(", ");
+		}
+		
+		printf("%li", intarray_get(array, i));
+	}
+	
+	printf("]");
+}
+
 static void print_value(Value value)
 {
 	PrintFrame frame = {.parent = cur_print_frame, .value = value};
@@ -116,12 +331,39 @@ static void print_value(Value value)
 		case TY_INT:
 			printf("%li", value.value);
 			break;
+		case TY_FLOAT:
+			print_float(value.floatval);
+			break;
 		case TY_STRING:
 			printf("%s", value.string);
 			break;
 		case TY_ARRAY:
 			print_array(value.array);
 			break;
+		case TY_INTARRAY:
+			print_intarray(value.intarray);
+			break;
+		case TY_SLICE:
+			print_slice(value.slice);
+			break;
+		case TY_BITSET:
+			print_bitset(value.bitset);
+			break;
+		case TY_DEQUE:
+			print_deque(value.deque);
+			break;
+		case TY_PQUEUE:
+			print_pqueue(value.pqueue);
+			break;
+		case TY_MAP:
+			print_map(value.map);
+			break;
+		case TY_OMAP:
+			print_omap(value.omap);
+			break;
+		case TY_STRUCT:
+			print_struct(value.structure);
+			break;
 		case TY_FUNCTION:
 			printf("<function %p>", *(void**)&value.func);
 			break;
@@ -147,19 +389,38 @@ void print(int64_t num, ...)
 	printf("\n");
 }
 
-Value check_type(int64_t cur_line, Type mintype, Type maxtype, Value value)
+Value wrong_type(int64_t cur_line)
+{
+	return *error(cur_line, "wrong type");
+}
+
+int64_t division_by_zero(int64_t cur_line)
+{
+	error(cur_line, "division by zero");
+	return 0;
+}
+
+static void omap_mark(OMapNode *node)
 {
-	if(value.type < mintype || value.type > maxtype) {
-		error(cur_line, "wrong type");
+	for(int64_t i=0; i < node->count; i++) {
+		gc_mark(node->values[i]);
 	}
 	
-	return value;
+	if(!node->leaf) {
+		for(int64_t i=0; i <= node->count; i++) {
+			omap_mark(node->children[i]);
+		}
+	}
 }
 
 static void gc_mark(Value value)
 {
 	if(
-		value.type == TY_ARRAY || value.type == TY_FUNCTION ||
+		value.type == TY_ARRAY || value.type == TY_INTARRAY ||
+		value.type == TY_SLICE || value.type == TY_BITSET ||
+		value.type == TY_DEQUE || value.type == TY_PQUEUE ||
+		value.type == TY_MAP || value.type == TY_OMAP ||
+		value.type == TY_STRUCT || value.type == TY_FUNCTION ||
 		value.type == TYX_REFERENCE
 	) {
 		MemBlock *block = value.ptr;
@@ -181,6 +442,44 @@ static void gc_mark(Value value)
 			gc_mark(array->items[i]);
 		}
 	}
+	else if(value.type == TY_SLICE) {
+		gc_mark(value.slice->parent);
+	}
+	else if(value.type == TY_DEQUE) {
+		Deque *deque = value.deque;
+		
+		for(int64_t i=0; i < deque->length; i++) {
+			gc_mark(deque->items[(deque->head + i) & (deque->capacity - 1)]);
+		}
+	}
+	else if(value.type == TY_PQUEUE) {
+		PQueue *queue = value.pqueue;
+		
+		for(int64_t i=0; i < queue->length; i++) {
+			gc_mark(queue->values[i]);
+		}
+	}
+	else if(value.type == TY_MAP) {
+		Map *map = value.map;
+		
+		for(int64_t i=0; i < map->capacity; i++) {
+			if(map->ctrl[i] < MAP_EMPTY) {
+				gc_mark(map->entries[i].value);
+			}
+		}
+	}
+	else if(value.type == TY_OMAP) {
+		if(value.omap->root) {
+			omap_mark(value.omap->root);
+		}
+	}
+	else if(value.type == TY_STRUCT) {
+		Struct *structure = value.structure;
+		
+		for(int64_t i=0; i < structure->shape->field_count; i++) {
+			gc_mark(structure->fields[i]);
+		}
+	}
 	else if(value.type == TY_FUNCTION) {
 		Function *func = value.func;
 		
@@ -194,6 +493,54 @@ static void gc_mark(Value value)
 	}
 }
 
+static void omap_free(OMapNode *node)
+{
+	if(!node->leaf) {
+		for(int64_t i=0; i <= node->count; i++) {
+			omap_free(node->children[i]);
+		}
+	}
+	
+	free(node);
+}
+
+static void free_block_data(MemBlock *block)
+{
+	if(block->type == TY_ARRAY) {
+		Array *array = (Array*)block->data;
+		free(array->items);
+	}
+	else if(block->type == TY_INTARRAY) {
+		IntArray *array = (IntArray*)block->data;
+		free(array->items);
+	}
+	else if(block->type == TY_DEQUE) {
+		Deque *deque = (Deque*)block->data;
+		free(deque->items);
+	}
+	else if(block->type == TY_PQUEUE) {
+		PQueue *queue = (PQueue*)block->data;
+		free(queue->priorities);
+		free(queue->values);
+	}
+	else if(block->type == TY_BITSET) {
+		Bitset *bitset = (Bitset*)block->data;
+		free(bitset->words);
+	}
+	else if(block->type == TY_MAP) {
+		Map *map = (Map*)block->data;
+		free(map->ctrl);
+		free(map->entries);
+	}
+	else if(block->type == TY_OMAP) {
+		OMap *map = (OMap*)block->data;
+		
+		if(map->root) {
+			omap_free(map->root);
+		}
+	}
+}
+
 static void collect_garbage()
 {
 	for(ScopeFrame *frame = cur_scope_frame; frame; frame = frame->parent) {
@@ -203,8 +550,20 @@ static void collect_garbage()
 		}
 	}
 	
+	// cached results of memo functions are roots too
+	for(Memo *memo = first_memo; memo; memo = memo->next) {
+		int64_t slot_count = memo->set_count * MEMO_WAYS;
+		
+		for(int64_t i=0; i < slot_count; i++) {
+			if(memo->stamps[i]) {
+				gc_mark(memo->slots[i * (memo->arity + 1)]);
+			}
+		}
+	}
+	
 	for(MemBlock *block = first_block, *prev = 0; block;) {
 		if(block->mark == 0) {
+			free_block_data(block);
 			((int64_t*)block->data)[0] = 0;
 			
 			DEBUG_printf("freeing %p\n", (void*)block);
@@ -232,10 +591,11 @@ static void collect_garbage()
 	}
 }
 
-static void *mem_alloc(int64_t size)
+static void *mem_alloc(Type type, int64_t size)
 {
 	collect_garbage();
 	MemBlock *block = calloc(1, sizeof(MemBlock) + size);
+	block->type = type;
 	
 	if(first_block) {
 		last_block->next = block;
@@ -252,140 +612,1991 @@ static void *mem_alloc(int64_t size)
 	return block->data;
 }
 
-Array *new_array(int64_t length, ...)
+Array *new_array(int64_t length)
 {
-	Value items[length];
-	PUSH_SCOPE(items, 0);
-	va_list args;
-	va_start(args, length);
-	
-	for(int64_t i=0; i < length; i++) {
-		items[i] = va_arg(args, Value);
-	}
-	
-	va_end(args);
-	Array *array = mem_alloc(sizeof(Array) + length * sizeof(Value));
+	Array *array = mem_alloc(TY_ARRAY, sizeof(Array));
 	array->length = length;
-	
-	for(int64_t i=0; i < length; i++) {
-		array->items[i] = items[i];
-	}
-	
-	POP_SCOPE();
+	array->capacity = length;
+	array->items = calloc(length, sizeof(Value));
 	return array;
 }
 
-Value uplift_var(Value *var)
+Array *new_array_from(int64_t length, const Value *template)
 {
-	DEBUG_printf("new uplift\n");
-	
-	Value *lifted = mem_alloc(sizeof(Value));
-	*lifted = *var;
-	*var = REFERENCE(lifted);
-	return *var;
+	Array *array = mem_alloc(TY_ARRAY, sizeof(Array));
+	array->length = length;
+	array->capacity = length;
+	array->items = malloc(length * sizeof(Value));
+	memcpy(array->items, template, length * sizeof(Value));
+	return array;
 }
 
-Function *new_function(
-	FuncPtr funcptr, int64_t arity, int64_t enclosed_count, ...
-) {
-	DEBUG_printf(
-		"new function %li %li size %li\n",
-		arity, enclosed_count,
-		sizeof(Function) + enclosed_count * sizeof(Value)
-	);
-	
-	Function *func = mem_alloc(
-		sizeof(Function) + enclosed_count * sizeof(Value)
-	);
-	
-	int64_t tmp_count = 1 + enclosed_count;
-	Value tmp[tmp_count];
-	
-	for(int64_t i=0; i < tmp_count; i++) {
-		tmp[i].type = TYX_UNINITIALIZED;
-	}
-	
-	tmp[0] = FUNCTION_VALUE(func);
-	PUSH_SCOPE(tmp, 0);
-	
-	func->func = funcptr;
-	func->arity = arity;
-	func->enclosed_count = enclosed_count;
-	va_list args;
-	va_start(args, enclosed_count);
+// Maps are open addressing hash tables with one control byte per slot: either
+// MAP_EMPTY, MAP_DELETED or the low 7 bits of the hash of the key stored there.
+// Control bytes are probed in groups of 8 at once as one 64 bit word.
+
+Map *new_map()
+{
+	return mem_alloc(TY_MAP, sizeof(Map));
+}
+
+static uint64_t hash_value(Value key)
+{
+	uint64_t hash = key.value;
 	
-	for(int64_t i=0; i < enclosed_count; i++) {
-		Value *var = va_arg(args, Value*);
+	if(key.type == TY_STRING) {
+		hash = 0xcbf29ce484222325u;
 		
-		if(var->type == TYX_REFERENCE) {
-			func->enclosed[i] = *var;
-			DEBUG_printf("already uplifted\n");
-		}
-		else {
-			func->enclosed[i] = uplift_var(var);
+		for(char *c = key.string; *c; c++) {
+			hash = (hash ^ (uint8_t)*c) * 0x100000001b3u;
 		}
-		
-		tmp[1 + i] = func->enclosed[i];
 	}
 	
-	va_end(args);
-	POP_SCOPE();
-	return func;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdu;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53u;
+	hash ^= hash >> 33;
+	return hash;
 }
 
-Value call(int64_t cur_line, Value value, int64_t argcount, ...)
+static uint64_t hash_key(int64_t cur_line, Value key)
 {
-	if(value.type == TYX_UNINITIALIZED) {
-		error(cur_line, "function is not yet initialized");
-	}
-	else if(value.type != TY_FUNCTION) {
-		error(cur_line, "callee is not callable");
-	}
-	else if(value.func->arity != argcount) {
-		error(
-			cur_line,
-			"callee needs %li arguments but got %li",
-			value.func->arity, argcount
-		);
+	if(key.type != TY_INT && key.type != TY_STRING) {
+		error(cur_line, "map keys must be integers or strings");
 	}
 	
-	Function *func = value.func;
-	va_list args;
-	va_start(args, argcount);
+	return hash_value(key);
+}
+
+static bool keys_equal(Value a, Value b)
+{
+	if(a.type != b.type) {
+		return false;
+	}
+	else if(a.type == TY_STRING) {
+		return a.string == b.string || strcmp(a.string, b.string) == 0;
+	}
+	
+	return a.value == b.value;
+}
+
+static uint64_t map_group(Map *map, int64_t group)
+{
+	uint64_t word;
+	memcpy(&word, map->ctrl + group * MAP_GROUP_WIDTH, sizeof(word));
+	return word;
+}
+
+static uint64_t group_match(uint64_t word, uint8_t h2)
+{
+	uint64_t x = word ^ MAP_LSBS * h2;
+	return (x - MAP_LSBS) & ~x & MAP_MSBS;
+}
+
+static uint64_t group_match_empty(uint64_t word)
+{
+	return word & ~word << 6 & MAP_MSBS;
+}
+
+static uint64_t group_match_free(uint64_t word)
+{
+	return word & ~word << 7 & MAP_MSBS;
+}
+
+static int64_t group_slot(int64_t group, uint64_t match)
+{
+	return group * MAP_GROUP_WIDTH + __builtin_ctzll(match) / 8;
+}
+
+static int64_t map_find(Map *map, Value key, uint64_t hash)
+{
+	if(map->capacity == 0) {
+		return -1;
+	}
+	
+	int64_t mask = map->capacity / MAP_GROUP_WIDTH - 1;
+	int64_t group = hash >> 7 & mask;
+	
+	for(int64_t step = 1;; step++) {
+		uint64_t word = map_group(map, group);
+		
+		for(uint64_t m = group_match(word, hash & 0x7f); m; m &= m - 1) {
+			int64_t slot = group_slot(group, m);
+			
+			if(keys_equal(map->entries[slot].key, key)) {
+				return slot;
+			}
+		}
+		
+		if(group_match_empty(word)) {
+			return -1;
+		}
+		
+		group = (group + step) & mask;
+	}
+}
+
+static int64_t map_free_slot(Map *map, uint64_t hash)
+{
+	int64_t mask = map->capacity / MAP_GROUP_WIDTH - 1;
+	int64_t group = hash >> 7 & mask;
+	
+	for(int64_t step = 1;; step++) {
+		uint64_t match = group_match_free(map_group(map, group));
+		
+		if(match) {
+			return group_slot(group, match);
+		}
+		
+		group = (group + step) & mask;
+	}
+}
+
+static void map_rehash(Map *map)
+{
+	int64_t old_capacity = map->capacity;
+	uint8_t *old_ctrl = map->ctrl;
+	MapEntry *old_entries = map->entries;
+	int64_t capacity = MAP_GROUP_WIDTH;
+	
+	while(capacity * 7 < (map->length + 1) * 16) {
+		capacity *= 2;
+	}
+	
+	map->capacity = capacity;
+	map->tombstones = 0;
+	map->ctrl = malloc(capacity);
+	map->entries = malloc(capacity * sizeof(MapEntry));
+	memset(map->ctrl, MAP_EMPTY, capacity);
+	
+	for(int64_t i=0; i < old_capacity; i++) {
+		if(old_ctrl[i] < MAP_EMPTY) {
+			MapEntry *entry = old_entries + i;
+			int64_t slot = map_free_slot(map, hash_key(0, entry->key));
+			map->ctrl[slot] = old_ctrl[i];
+			map->entries[slot] = *entry;
+		}
+	}
+	
+	free(old_ctrl);
+	free(old_entries);
+}
+
+void map_set(int64_t cur_line, Map *map, Value key, Value value)
+{
+	uint64_t hash = hash_key(cur_line, key);
+	int64_t slot = map_find(map, key, hash);
+	
+	if(slot >= 0) {
+		map->entries[slot].value = value;
+		return;
+	}
+	
+	if((map->length + map->tombstones + 1) * 8 > map->capacity * 7) {
+		map_rehash(map);
+	}
+	
+	slot = map_free_slot(map, hash);
+	
+	if(map->ctrl[slot] == MAP_DELETED) {
+		map->tombstones --;
+	}
+	
+	map->ctrl[slot] = hash & 0x7f;
+	map->entries[slot] = (MapEntry){.key = key, .value = value};
+	map->length ++;
+}
+
+static Value map_get(int64_t cur_line, Map *map, Value key)
+{
+	int64_t slot = map_find(map, key, hash_key(cur_line, key));
+	
+	if(slot < 0) {
+		error(cur_line, "map key not found");
+	}
+	
+	return map->entries[slot].value;
+}
+
+// Ordered maps are B-trees over int keys. The keys of a node sit next to each
+// other so a lookup scans a couple of cache lines per level. Leaves are
+// allocated without the children array. Nodes live outside the GC heap and are
+// owned by their map block.
+
+static OMapNode *omap_node(bool leaf)
+{
+	OMapNode *node = malloc(
+		leaf ? offsetof(OMapNode, children) : sizeof(OMapNode)
+	);
+	
+	node->count = 0;
+	node->leaf = leaf;
+	return node;
+}
+
+static int64_t omap_key(int64_t cur_line, Value key)
+{
+	if(key.type != TY_INT) {
+		error(cur_line, "ordered map keys must be integers");
+	}
+	
+	return key.value;
+}
+
+static int64_t node_search(OMapNode *node, int64_t key)
+{
+	int64_t i = 0;
+	
+	while(i < node->count && node->keys[i] < key) {
+		i ++;
+	}
+	
+	return i;
+}
+
+static Value *omap_find(OMap *map, int64_t key)
+{
+	OMapNode *node = map->root;
+	
+	while(node) {
+		int64_t i = node_search(node, key);
+		
+		if(i < node->count && node->keys[i] == key) {
+			return node->values + i;
+		}
+		else if(node->leaf) {
+			break;
+		}
+		
+		node = node->children[i];
+	}
+	
+	return 0;
+}
+
+static void node_insert_at(OMapNode *node, int64_t i, int64_t key, Value value)
+{
+	int64_t tail = node->count - i;
+	memmove(node->keys + i + 1, node->keys + i, tail * sizeof(int64_t));
+	memmove(node->values + i + 1, node->values + i, tail * sizeof(Value));
+	node->keys[i] = key;
+	node->values[i] = value;
+	node->count ++;
+}
+
+static void node_remove_at(OMapNode *node, int64_t i)
+{
+	int64_t tail = node->count - i - 1;
+	memmove(node->keys + i, node->keys + i + 1, tail * sizeof(int64_t));
+	memmove(node->values + i, node->values + i + 1, tail * sizeof(Value));
+	node->count --;
+}
+
+// Splits the full child i of parent around its median key, which moves up
+// into parent.
+
+static void omap_split(OMapNode *parent, int64_t i)
+{
+	OMapNode *left = parent->children[i];
+	OMapNode *right = omap_node(left->leaf);
+	int64_t half = OMAP_DEGREE - 1;
+	
+	memcpy(right->keys, left->keys + OMAP_DEGREE, half * sizeof(int64_t));
+	memcpy(right->values, left->values + OMAP_DEGREE, half * sizeof(Value));
+	
+	if(!left->leaf) {
+		memcpy(
+			right->children, left->children + OMAP_DEGREE,
+			OMAP_DEGREE * sizeof(OMapNode*)
+		);
+	}
+	
+	right->count = half;
+	left->count = half;
+	
+	memmove(
+		parent->children + i + 2, parent->children + i + 1,
+		(parent->count - i) * sizeof(OMapNode*)
+	);
+	
+	parent->children[i + 1] = right;
+	node_insert_at(parent, i, left->keys[half], left->values[half]);
+}
+
+static void omap_set(int64_t cur_line, OMap *map, Value key, Value value)
+{
+	int64_t k = omap_key(cur_line, key);
+	
+	if(!map->root) {
+		map->root = omap_node(true);
+	}
+	else if(map->root->count == OMAP_MAX_KEYS) {
+		OMapNode *root = omap_node(false);
+		root->children[0] = map->root;
+		omap_split(root, 0);
+		map->root = root;
+	}
+	
+	OMapNode *node = map->root;
+	
+	while(true) {
+		int64_t i = node_search(node, k);
+		
+		if(i < node->count && node->keys[i] == k) {
+			node->values[i] = value;
+			return;
+		}
+		else if(node->leaf) {
+			node_insert_at(node, i, k, value);
+			map->length ++;
+			return;
+		}
+		
+		if(node->children[i]->count == OMAP_MAX_KEYS) {
+			omap_split(node, i);
+			
+			if(node->keys[i] == k) {
+				node->values[i] = value;
+				return;
+			}
+			else if(node->keys[i] < k) {
+				i ++;
+			}
+		}
+		
+		node = node->children[i];
+	}
+}
+
+static Value omap_get(int64_t cur_line, OMap *map, Value key)
+{
+	Value *value = omap_find(map, omap_key(cur_line, key));
+	
+	if(!value) {
+		error(cur_line, "ordered map key not found");
+	}
+	
+	return *value;
+}
+
+// Merges child i + 1 of parent and the key between them into child i.
+
+static void omap_merge(OMapNode *parent, int64_t i)
+{
+	OMapNode *left = parent->children[i];
+	OMapNode *right = parent->children[i + 1];
+	
+	left->keys[left->count] = parent->keys[i];
+	left->values[left->count] = parent->values[i];
+	
+	memcpy(
+		left->keys + left->count + 1, right->keys,
+		right->count * sizeof(int64_t)
+	);
+	
+	memcpy(
+		left->values + left->count + 1, right->values,
+		right->count * sizeof(Value)
+	);
+	
+	if(!left->leaf) {
+		memcpy(
+			left->children + left->count + 1, right->children,
+			(right->count + 1) * sizeof(OMapNode*)
+		);
+	}
+	
+	left->count += right->count + 1;
+	free(right);
+	
+	node_remove_at(parent, i);
+	
+	memmove(
+		parent->children + i + 1, parent->children + i + 2,
+		(parent->count - i) * sizeof(OMapNode*)
+	);
+}
+
+// Makes sure child i of node has a key to spare before descending into it, by
+// borrowing from a sibling through the parent or by merging with one. Returns
+// the index of the child that now covers the range.
+
+static int64_t omap_fill(OMapNode *node, int64_t i)
+{
+	OMapNode *child = node->children[i];
+	
+	if(child->count >= OMAP_DEGREE) {
+		return i;
+	}
+	
+	if(i > 0 && node->children[i - 1]->count >= OMAP_DEGREE) {
+		OMapNode *left = node->children[i - 1];
+		node_insert_at(child, 0, node->keys[i - 1], node->values[i - 1]);
+		
+		if(!child->leaf) {
+			memmove(
+				child->children + 1, child->children,
+				child->count * sizeof(OMapNode*)
+			);
+			
+			child->children[0] = left->children[left->count];
+		}
+		
+		left->count --;
+		node->keys[i - 1] = left->keys[left->count];
+		node->values[i - 1] = left->values[left->count];
+	}
+	else if(i < node->count && node->children[i + 1]->count >= OMAP_DEGREE) {
+		OMapNode *right = node->children[i + 1];
+		node_insert_at(child, child->count, node->keys[i], node->values[i]);
+		node->keys[i] = right->keys[0];
+		node->values[i] = right->values[0];
+		
+		if(!child->leaf) {
+			child->children[child->count] = right->children[0];
+			
+			memmove(
+				right->children, right->children + 1,
+				right->count * sizeof(OMapNode*)
+			);
+		}
+		
+		node_remove_at(right, 0);
+	}
+	else if(i < node->count) {
+		omap_merge(node, i);
+	}
+	else {
+		omap_merge(node, i - 1);
+		i --;
+	}
+	
+	return i;
+}
+
+static bool omap_erase(OMapNode *node, int64_t key)
+{
+	while(true) {
+		int64_t i = node_search(node, key);
+		
+		if(i < node->count && node->keys[i] == key) {
+			if(node->leaf) {
+				node_remove_at(node, i);
+				return true;
+			}
+			
+			OMapNode *left = node->children[i];
+			OMapNode *right = node->children[i + 1];
+			
+			if(left->count >= OMAP_DEGREE) {
+				OMapNode *pred = left;
+				
+				while(!pred->leaf) {
+					pred = pred->children[pred->count];
+				}
+				
+				key = pred->keys[pred->count - 1];
+				node->keys[i] = key;
+				node->values[i] = pred->values[pred->count - 1];
+				node = left;
+			}
+			else if(right->count >= OMAP_DEGREE) {
+				OMapNode *succ = right;
+				
+				while(!succ->leaf) {
+					succ = succ->children[0];
+				}
+				
+				key = succ->keys[0];
+				node->keys[i] = key;
+				node->values[i] = succ->values[0];
+				node = right;
+			}
+			else {
+				omap_merge(node, i);
+				node = left;
+			}
+		}
+		else if(node->leaf) {
+			return false;
+		}
+		else {
+			node = node->children[omap_fill(node, i)];
+		}
+	}
+}
+
+// A memo table is a set associative cache from argument tuples to results.
+// Each tuple hashes to a set of MEMO_WAYS slots. When the set is full the policy
+// picks the slot to replace: MEMO_LRU the least recently used one, MEMO_FIFO the
+// one stored first, and MEMO_KEEP none, so the new result is not cached. A slot
+// holds the result followed by the arguments. Only calls with int and string
+// arguments are cached.
+
+static bool memo_cacheable(Memo *memo, Value *args)
+{
+	for(int64_t i=0; i < memo->arity; i++) {
+		if(args[i].type != TY_INT && args[i].type != TY_STRING) {
+			return false;
+		}
+	}
+	
+	if(!memo->stamps) {
+		memo->set_count = 1;
+		
+		while(memo->set_count * MEMO_WAYS < memo->capacity) {
+			memo->set_count *= 2;
+		}
+		
+		int64_t slot_count = memo->set_count * MEMO_WAYS;
+		memo->stamps = calloc(slot_count, sizeof(uint64_t));
+		memo->slots = calloc(slot_count * (memo->arity + 1), sizeof(Value));
+		memo->next = first_memo;
+		first_memo = memo;
+	}
+	
+	return true;
+}
+
+static Value *memo_set(Memo *memo, Value *args)
+{
+	uint64_t hash = 0;
+	
+	for(int64_t i=0; i < memo->arity; i++) {
+		hash = (hash ^ hash_value(args[i])) * 0x100000001b3u;
+	}
+	
+	hash ^= hash >> 29;
+	int64_t set = hash & (memo->set_count - 1);
+	return memo->slots + set * MEMO_WAYS * (memo->arity + 1);
+}
+
+static bool memo_match(Memo *memo, Value *slot, Value *args)
+{
+	for(int64_t i=0; i < memo->arity; i++) {
+		if(!keys_equal(slot[1 + i], args[i])) {
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+Value *memo_find(Memo *memo, Value *args)
+{
+	if(!memo_cacheable(memo, args)) {
+		return 0;
+	}
+	
+	Value *slot = memo_set(memo, args);
+	int64_t first = (slot - memo->slots) / (memo->arity + 1);
+	
+	for(int64_t i=0; i < MEMO_WAYS; i++, slot += memo->arity + 1) {
+		if(memo->stamps[first + i] && memo_match(memo, slot, args)) {
+			if(memo->policy == MEMO_LRU) {
+				memo->clock ++;
+				memo->stamps[first + i] = memo->clock;
+			}
+			
+			return slot;
+		}
+	}
+	
+	return 0;
+}
+
+Value memo_store(Memo *memo, Value *args, Value result)
+{
+	if(!memo_cacheable(memo, args)) {
+		return result;
+	}
+	
+	Value *slots = memo_set(memo, args);
+	int64_t first = (slots - memo->slots) / (memo->arity + 1);
+	int64_t victim = 0;
+	
+	for(int64_t i=1; i < MEMO_WAYS; i++) {
+		if(memo->stamps[first + i] < memo->stamps[first + victim]) {
+			victim = i;
+		}
+	}
+	
+	if(memo->policy == MEMO_KEEP && memo->stamps[first + victim]) {
+		return result;
+	}
+	
+	Value *slot = slots + victim * (memo->arity + 1);
+	slot[0] = result;
+	memcpy(slot + 1, args, memo->arity * sizeof(Value));
+	memo->clock ++;
+	memo->stamps[first + victim] = memo->clock;
+	return result;
+}
+
+Struct *new_struct(Shape *shape)
+{
+	Struct *structure = mem_alloc(
+		TY_STRUCT, sizeof(Struct) + shape->field_count * sizeof(Value)
+	);
+	
+	structure->shape = shape;
+	return structure;
+}
+
+Value *shape_mismatch(int64_t cur_line, Value value, Shape *shape)
+{
+	if(value.type != TY_STRUCT) {
+		return error(cur_line, "this is not a struct %s", shape->name);
+	}
+	
+	return error(
+		cur_line, "this is a struct %s, not a struct %s",
+		value.structure->shape->name, shape->name
+	);
+}
+
+Value *struct_field_named(int64_t cur_line, Value value, char *name)
+{
+	if(value.type != TY_STRUCT) {
+		return error(cur_line, "this is not a struct");
+	}
+	
+	Shape *shape = value.structure->shape;
+	
+	for(int64_t i=0; i < shape->field_count; i++) {
+		if(strcmp(shape->fields[i], name) == 0) {
+			return value.structure->fields + i;
+		}
+	}
+	
+	return error(cur_line, "struct %s has no field %s", shape->name, name);
+}
+
+Value uplift_var(Value *var)
+{
+	DEBUG_printf("new uplift\n");
+	
+	Value *lifted = mem_alloc(TYX_REFERENCE, sizeof(Value));
+	*lifted = *var;
+	*var = REFERENCE(lifted);
+	return *var;
+}
+
+Function *new_function(
+	FuncPtr funcptr, int64_t arity, int64_t enclosed_count, ...
+) {
+	DEBUG_printf(
+		"new function %li %li size %li\n",
+		arity, enclosed_count,
+		sizeof(Function) + enclosed_count * sizeof(Value)
+	);
+	
+	Function *func = mem_alloc(
+		TY_FUNCTION, sizeof(Function) + enclosed_count * sizeof(Value)
+	);
+	
+	int64_t tmp_count = 1 + enclosed_count;
+	Value tmp[tmp_count];
+	
+	for(int64_t i=0; i < tmp_count; i++) {
+		tmp[i].type = TYX_UNINITIALIZED;
+	}
+	
+	tmp[0] = FUNCTION_VALUE(func);
+	PUSH_SCOPE(tmp, 0);
+	
+	func->func = funcptr;
+	func->arity = arity;
+	func->enclosed_count = enclosed_count;
+	va_list args;
+	va_start(args, enclosed_count);
+	
+	for(int64_t i=0; i < enclosed_count; i++) {
+		Value *var = va_arg(args, Value*);
+		
+		if(var->type == TYX_REFERENCE) {
+			func->enclosed[i] = *var;
+			DEBUG_printf("already uplifted\n");
+		}
+		else {
+			func->enclosed[i] = uplift_var(var);
+		}
+		
+		tmp[1 + i] = func->enclosed[i];
+	}
+	
+	va_end(args);
+	POP_SCOPE();
+	return func;
+}
+
+Value *function_uninitialized(int64_t cur_line)
+{
+	return error(cur_line, "function is not yet initialized");
+}
+
+Value call_failed(int64_t cur_line, Value value, int64_t argcount)
+{
+	if(value.type == TYX_UNINITIALIZED) {
+		return *error(cur_line, "function is not yet initialized");
+	}
+	else if(value.type != TY_FUNCTION) {
+		return *error(cur_line, "callee is not callable");
+	}
+	
+	return *error(
+		cur_line,
+		"callee needs %li arguments but got %li",
+		value.func->arity, argcount
+	);
+}
+
+static int64_t check_index(int64_t cur_line, Value array, Value index)
+{
+	int64_t length = 0;
+	
+	if(array.type == TY_ARRAY) {
+		length = array.array->length;
+	}
+	else if(array.type == TY_INTARRAY) {
+		length = array.intarray->length;
+	}
+	else if(array.type == TY_SLICE) {
+		length = array.slice->length;
+	}
+	else if(array.type == TY_DEQUE) {
+		length = array.deque->length;
+	}
+	else {
+		error(cur_line, "this is not an array");
+	}
+	
+	if(index.type != TY_INT) {
+		error(cur_line, "subscript index is not an integer");
+	}
+	
+	if(index.value < 0 || index.value >= length) {
+		error(cur_line, "array index out of range");
+	}
+	
+	return index.value;
+}
+
+Value subscript_any(int64_t cur_line, Value array, Value index)
+{
+	if(array.type == TY_MAP) {
+		return map_get(cur_line, array.map, index);
+	}
+	else if(array.type == TY_OMAP) {
+		return omap_get(cur_line, array.omap, index);
+	}
+	
+	int64_t i = check_index(cur_line, array, index);
+	
+	if(array.type == TY_SLICE) {
+		Slice *slice = array.slice;
+		return subscript(cur_line, slice->parent, INT_VALUE(slice->offset + i));
+	}
+	else if(array.type == TY_INTARRAY) {
+		return INT_VALUE(intarray_get(array.intarray, i));
+	}
+	else if(array.type == TY_DEQUE) {
+		Deque *deque = array.deque;
+		return deque->items[(deque->head + i) & (deque->capacity - 1)];
+	}
+	
+	return array.array->items[i];
+}
+
+// A slice is a view on a range of an array or int array. Slicing a slice again
+// refers to the same parent, so item access never goes through more than one
+// indirection.
+
+Value slice(int64_t cur_line, Value array, Value start, Value stop)
+{
+	Value parent = array;
+	int64_t offset = 0;
+	int64_t length = 0;
+	
+	if(array.type == TY_ARRAY) {
+		length = array.array->length;
+	}
+	else if(array.type == TY_INTARRAY) {
+		length = array.intarray->length;
+	}
+	else if(array.type == TY_SLICE) {
+		parent = array.slice->parent;
+		offset = array.slice->offset;
+		length = array.slice->length;
+	}
+	else {
+		error(cur_line, "this is not an array");
+	}
+	
+	if(
+		start.type != TY_NULL && start.type != TY_INT ||
+		stop.type != TY_NULL && stop.type != TY_INT
+	) {
+		error(cur_line, "slice bounds are not integers");
+	}
+	
+	int64_t begin = start.type == TY_NULL ? 0 : start.value;
+	int64_t end = stop.type == TY_NULL ? length : stop.value;
+	
+	if(begin < 0 || end < begin || end > length) {
+		error(cur_line, "slice out of range");
+	}
+	
+	Slice *result = mem_alloc(TY_SLICE, sizeof(Slice));
+	result->parent = parent;
+	result->offset = offset + begin;
+	result->length = end - begin;
+	return SLICE_VALUE(result);
+}
+
+// the integer to store as an item of a packed array of the kind
+static int64_t check_int_item(int64_t cur_line, IntKind kind, Value value)
+{
+	int64_t x = check_type(cur_line, TY_NULL, TY_INT, value).value;
+	
+	if(
+		kind == IK_INT32 && (x < INT32_MIN || x > INT32_MAX) ||
+		kind == IK_UINT8 && (x < 0 || x > UINT8_MAX)
+	) {
+		error(cur_line, "integer %li does not fit into the array", x);
+	}
+	
+	return x;
+}
+
+void assign_subscript(
+	int64_t cur_line, Value array, Value index, Value value
+) {
+	if(array.type == TY_MAP) {
+		map_set(cur_line, array.map, index, value);
+		return;
+	}
+	else if(array.type == TY_OMAP) {
+		omap_set(cur_line, array.omap, index, value);
+		return;
+	}
+	
+	int64_t i = check_index(cur_line, array, index);
+	
+	if(array.type == TY_SLICE) {
+		Slice *slice = array.slice;
+		
+		assign_subscript(
+			cur_line, slice->parent, INT_VALUE(slice->offset + i), value
+		);
+	}
+	else if(array.type == TY_INTARRAY) {
+		IntArray *a = array.intarray;
+		intarray_set(a, i, check_int_item(cur_line, a->kind, value));
+	}
+	else if(array.type == TY_DEQUE) {
+		Deque *deque = array.deque;
+		deque->items[(deque->head + i) & (deque->capacity - 1)] = value;
+	}
+	else {
+		array.array->items[i] = value;
+	}
+}
+
+bool truthy_any(Value value)
+{
+	if(value.type == TY_STRING) {
+		return value.string[0] != 0;
+	}
+	else if(value.type == TY_ARRAY) {
+		return value.array->length != 0;
+	}
+	else if(value.type == TY_INTARRAY) {
+		return value.intarray->length != 0;
+	}
+	else if(value.type == TY_SLICE) {
+		return value.slice->length != 0;
+	}
+	else if(value.type == TY_BITSET) {
+		return value.bitset->length != 0;
+	}
+	else if(value.type == TY_DEQUE) {
+		return value.deque->length != 0;
+	}
+	else if(value.type == TY_PQUEUE) {
+		return value.pqueue->length != 0;
+	}
+	else if(value.type == TY_MAP) {
+		return value.map->length != 0;
+	}
+	else if(value.type == TY_OMAP) {
+		return value.omap->length != 0;
+	}
+	else if(value.type == TY_STRUCT || value.type == TY_FUNCTION) {
+		return true;
+	}
+	else if(value.type == TY_FLOAT) {
+		return value.floatval != 0;
+	}
+	
+	return value.value;
+}
+
+static void *grow_items(
+	void *items, int64_t *capacity, int64_t min_capacity, int64_t itemsize
+) {
+	int64_t new_capacity = *capacity > 0 ? *capacity * 2 : 4;
+	
+	if(new_capacity < min_capacity) {
+		new_capacity = min_capacity;
+	}
+	
+	*capacity = new_capacity;
+	return realloc(items, new_capacity * itemsize);
+}
+
+static int64_t intkind_size(IntKind kind)
+{
+	return kind == IK_INT64 ? 8 : kind == IK_INT32 ? 4 : 1;
+}
+
+Value builtin_len(int64_t cur_line, Value value)
+{
+	if(value.type == TY_ARRAY) {
+		return INT_VALUE(value.array->length);
+	}
+	else if(value.type == TY_INTARRAY) {
+		return INT_VALUE(value.intarray->length);
+	}
+	else if(value.type == TY_SLICE) {
+		return INT_VALUE(value.slice->length);
+	}
+	else if(value.type == TY_BITSET) {
+		return INT_VALUE(value.bitset->length);
+	}
+	else if(value.type == TY_DEQUE) {
+		return INT_VALUE(value.deque->length);
+	}
+	else if(value.type == TY_PQUEUE) {
+		return INT_VALUE(value.pqueue->length);
+	}
+	else if(value.type == TY_MAP) {
+		return INT_VALUE(value.map->length);
+	}
+	else if(value.type == TY_OMAP) {
+		return INT_VALUE(value.omap->length);
+	}
+	else if(value.type == TY_STRING) {
+		return INT_VALUE(strlen(value.string));
+	}
+	
+	error(cur_line, "len() needs an array, a map or a string");
+	return NULL_VALUE;
+}
+
+// Deques are ring buffers with a power of two capacity, so wrapping an index
+// around is a single mask. When full they grow into a buffer twice as large
+// with the items unwrapped to start at 0.
+
+Value builtin_deque(int64_t cur_line)
+{
+	return DEQUE_VALUE(mem_alloc(TY_DEQUE, sizeof(Deque)));
+}
+
+static void deque_reserve(Deque *deque)
+{
+	if(deque->length < deque->capacity) {
+		return;
+	}
+	
+	int64_t capacity = deque->capacity > 0 ? deque->capacity * 2 : 8;
+	Value *items = malloc(capacity * sizeof(Value));
+	int64_t first = deque->capacity - deque->head;
+	
+	if(first > deque->length) {
+		first = deque->length;
+	}
+	
+	if(deque->length > 0) {
+		memcpy(items, deque->items + deque->head, first * sizeof(Value));
+		
+		memcpy(
+			items + first, deque->items,
+			(deque->length - first) * sizeof(Value)
+		);
+	}
+	
+	free(deque->items);
+	deque->items = items;
+	deque->capacity = capacity;
+	deque->head = 0;
+}
+
+static Deque *check_deque(int64_t cur_line, Value deque, char *name)
+{
+	if(deque.type != TY_DEQUE) {
+		error(cur_line, "%s() needs a deque", name);
+	}
+	
+	return deque.deque;
+}
+
+Value builtin_push_front(int64_t cur_line, Value deque, Value item)
+{
+	Deque *d = check_deque(cur_line, deque, "push_front");
+	deque_reserve(d);
+	d->head = (d->head - 1) & (d->capacity - 1);
+	d->items[d->head] = item;
+	d->length ++;
+	return NULL_VALUE;
+}
+
+Value builtin_pop_front(int64_t cur_line, Value deque)
+{
+	Deque *d = check_deque(cur_line, deque, "pop_front");
+	
+	if(d->length == 0) {
+		error(cur_line, "pop_front() from an empty deque");
+	}
+	
+	Value item = d->items[d->head];
+	d->head = (d->head + 1) & (d->capacity - 1);
+	d->length --;
+	return item;
+}
+
+Value builtin_push(int64_t cur_line, Value array, Value item)
+{
+	if(array.type == TY_ARRAY) {
+		Array *a = array.array;
+		
+		if(a->length == a->capacity) {
+			a->items = grow_items(
+				a->items, &a->capacity, a->length + 1, sizeof(Value)
+			);
+		}
+		
+		a->items[a->length] = item;
+		a->length ++;
+	}
+	else if(array.type == TY_INTARRAY) {
+		IntArray *a = array.intarray;
+		int64_t x = check_int_item(cur_line, a->kind, item);
+		
+		if(a->length == a->capacity) {
+			a->items = grow_items(
+				a->items, &a->capacity, a->length + 1, intkind_size(a->kind)
+			);
+		}
+		
+		intarray_set(a, a->length, x);
+		a->length ++;
+	}
+	else if(array.type == TY_DEQUE) {
+		Deque *d = array.deque;
+		deque_reserve(d);
+		d->items[(d->head + d->length) & (d->capacity - 1)] = item;
+		d->length ++;
+	}
+	else {
+		error(cur_line, "push() needs an array");
+	}
+	
+	return NULL_VALUE;
+}
+
+Value builtin_pop(int64_t cur_line, Value array)
+{
+	if(array.type == TY_ARRAY) {
+		Array *a = array.array;
+		
+		if(a->length == 0) {
+			error(cur_line, "pop() from an empty array");
+		}
+		
+		a->length --;
+		return a->items[a->length];
+	}
+	else if(array.type == TY_INTARRAY) {
+		IntArray *a = array.intarray;
+		
+		if(a->length == 0) {
+			error(cur_line, "pop() from an empty array");
+		}
+		
+		a->length --;
+		return INT_VALUE(intarray_get(a, a->length));
+	}
+	else if(array.type == TY_DEQUE) {
+		Deque *d = array.deque;
+		
+		if(d->length == 0) {
+			error(cur_line, "pop() from an empty deque");
+		}
+		
+		d->length --;
+		return d->items[(d->head + d->length) & (d->capacity - 1)];
+	}
+	
+	error(cur_line, "pop() needs an array");
+	return NULL_VALUE;
+}
+
+static Value new_intarray(int64_t cur_line, IntKind kind, Value length)
+{
+	length = check_type(cur_line, TY_INT, TY_INT, length);
+	
+	if(length.value < 0) {
+		error(cur_line, "array length must not be negative");
+	}
+	
+	IntArray *array = mem_alloc(TY_INTARRAY, sizeof(IntArray));
+	array->length = length.value;
+	array->capacity = length.value;
+	array->kind = kind;
+	array->items = calloc(length.value, intkind_size(kind));
+	return INTARRAY_VALUE(array);
+}
+
+Value builtin_int64_array(int64_t cur_line, Value length)
+{
+	return new_intarray(cur_line, IK_INT64, length);
+}
+
+Value builtin_int32_array(int64_t cur_line, Value length)
+{
+	return new_intarray(cur_line, IK_INT32, length);
+}
+
+Value builtin_uint8_array(int64_t cur_line, Value length)
+{
+	return new_intarray(cur_line, IK_UINT8, length);
+}
+
+// The bulk builtins work on whole arrays, int arrays or slices. They check the
+// bounds once per call and then move the raw items with memset, memcpy and
+// memcmp where the item layouts allow it.
+
+static Slice array_view(int64_t cur_line, Value array, char *name)
+{
+	Slice view = {.parent = array};
+	
+	if(array.type == TY_SLICE) {
+		view = *array.slice;
+	}
+	else if(array.type != TY_ARRAY && array.type != TY_INTARRAY) {
+		error(cur_line, "%s() needs an array", name);
+	}
+	
+	int64_t length = view.parent.type == TY_ARRAY ?
+		view.parent.array->length : view.parent.intarray->length;
+	
+	if(array.type != TY_SLICE) {
+		view.length = length;
+	}
+	else if(view.offset + view.length > length) {
+		error(cur_line, "slice out of range");
+	}
+	
+	return view;
+}
+
+static Value view_get(Slice *view, int64_t index)
+{
+	if(view->parent.type == TY_INTARRAY) {
+		return INT_VALUE(
+			intarray_get(view->parent.intarray, view->offset + index)
+		);
+	}
+	
+	return view->parent.array->items[view->offset + index];
+}
+
+static bool items_equal(Value a, Value b)
+{
+	if(a.type <= TY_INT && b.type <= TY_INT) {
+		return a.value == b.value;
+	}
+	else if(a.type <= TY_FLOAT && b.type <= TY_FLOAT) {
+		return
+			(a.type == TY_FLOAT ? a.floatval : a.value) ==
+			(b.type == TY_FLOAT ? b.floatval : b.value);
+	}
+	else if(a.type != b.type) {
+		return false;
+	}
+	else if(a.type == TY_STRING) {
+		return a.string == b.string || strcmp(a.string, b.string) == 0;
+	}
+	
+	return a.ptr == b.ptr;
+}
+
+Value builtin_fill(int64_t cur_line, Value array, Value value)
+{
+	Slice view = array_view(cur_line, array, "fill");
+	
+	if(view.parent.type == TY_ARRAY) {
+		Value *items = view.parent.array->items + view.offset;
+		
+		if(view.length > 0) {
+			items[0] = value;
+		}
+		
+		for(int64_t done = 1; done < view.length; done *= 2) {
+			int64_t count = done < view.length - done ?
+				done : view.length - done;
+			
+			memcpy(items + done, items, count * sizeof(Value));
+		}
+		
+		return array;
+	}
+	
+	IntArray *a = view.parent.intarray;
+	int64_t x = check_int_item(cur_line, a->kind, value);
+	int64_t size = intkind_size(a->kind);
+	char *items = (char*)a->items + view.offset * size;
+	
+	if(x == 0 || a->kind == IK_UINT8) {
+		memset(items, (uint8_t)x, view.length * size);
+	}
+	else if(a->kind == IK_INT32) {
+		for(int64_t i=0; i < view.length; i++) {
+			((int32_t*)items)[i] = x;
+		}
+	}
+	else {
+		for(int64_t i=0; i < view.length; i++) {
+			((int64_t*)items)[i] = x;
+		}
+	}
+	
+	return array;
+}
+
+Value builtin_copy(
+	int64_t cur_line, Value dst, Value dstoff, Value src, Value srcoff,
+	Value count
+) {
+	Slice to = array_view(cur_line, dst, "copy");
+	Slice from = array_view(cur_line, src, "copy");
+	int64_t n = check_type(cur_line, TY_INT, TY_INT, count).value;
+	int64_t to_offset = check_type(cur_line, TY_INT, TY_INT, dstoff).value;
+	int64_t from_offset = check_type(cur_line, TY_INT, TY_INT, srcoff).value;
+	
+	if(
+		n < 0 || to_offset < 0 || from_offset < 0 ||
+		to_offset > to.length - n || from_offset > from.length - n
+	) {
+		error(cur_line, "copy() out of range");
+	}
+	
+	to.offset += to_offset;
+	from.offset += from_offset;
+	
+	if(to.parent.type == TY_ARRAY && from.parent.type == TY_ARRAY) {
+		memmove(
+			to.parent.array->items + to.offset,
+			from.parent.array->items + from.offset,
+			n * sizeof(Value)
+		);
+	}
+	else if(
+		to.parent.type == TY_INTARRAY && from.parent.type == TY_INTARRAY &&
+		to.parent.intarray->kind == from.parent.intarray->kind
+	) {
+		int64_t size = intkind_size(to.parent.intarray->kind);
+		
+		memmove(
+			(char*)to.parent.intarray->items + to.offset * size,
+			(char*)from.parent.intarray->items + from.offset * size,
+			n * size
+		);
+	}
+	else if(to.parent.type == TY_ARRAY) {
+		for(int64_t i=0; i < n; i++) {
+			to.parent.array->items[to.offset + i] = view_get(&from, i);
+		}
+	}
+	else {
+		// different buffers, so they can not overlap
+		IntArray *a = to.parent.intarray;
+		
+		for(int64_t i=0; i < n; i++) {
+			int64_t x = check_int_item(cur_line, a->kind, view_get(&from, i));
+			intarray_set(a, to.offset + i, x);
+		}
+	}
+	
+	return NULL_VALUE;
+}
+
+Value builtin_equal(int64_t cur_line, Value a, Value b)
+{
+	Slice left = array_view(cur_line, a, "equal");
+	Slice right = array_view(cur_line, b, "equal");
+	
+	if(left.length != right.length) {
+		return BOOL_VALUE(false);
+	}
+	else if(
+		left.parent.type == TY_INTARRAY && right.parent.type == TY_INTARRAY &&
+		left.parent.intarray->kind == right.parent.intarray->kind
+	) {
+		int64_t size = intkind_size(left.parent.intarray->kind);
+		
+		return BOOL_VALUE(memcmp(
+			(char*)left.parent.intarray->items + left.offset * size,
+			(char*)right.parent.intarray->items + right.offset * size,
+			left.length * size
+		) == 0);
+	}
+	
+	for(int64_t i=0; i < left.length; i++) {
+		if(!items_equal(view_get(&left, i), view_get(&right, i))) {
+			return BOOL_VALUE(false);
+		}
+	}
+	
+	return BOOL_VALUE(true);
+}
+
+// Priority queues are implicit 4-ary min heaps. The priorities are kept apart
+// from the values, so the four children compared in a sift step share a
+// single cache line.
+
+#define PQ_ARITY 4
+
+Value builtin_pqueue(int64_t cur_line)
+{
+	return PQUEUE_VALUE(mem_alloc(TY_PQUEUE, sizeof(PQueue)));
+}
+
+static PQueue *check_pqueue(int64_t cur_line, Value queue, char *name)
+{
+	if(queue.type != TY_PQUEUE) {
+		error(cur_line, "%s() needs a priority queue", name);
+	}
+	
+	return queue.pqueue;
+}
+
+Value builtin_pq_push(int64_t cur_line, Value queue, Value priority, Value item)
+{
+	PQueue *q = check_pqueue(cur_line, queue, "pq_push");
+	int64_t prio = check_type(cur_line, TY_NULL, TY_INT, priority).value;
+	
+	if(q->length == q->capacity) {
+		int64_t capacity = q->capacity;
+		
+		q->priorities = grow_items(
+			q->priorities, &capacity, q->length + 1, sizeof(int64_t)
+		);
+		
+		q->values = grow_items(
+			q->values, &q->capacity, q->length + 1, sizeof(Value)
+		);
+	}
+	
+	int64_t i = q->length;
+	q->length ++;
+	
+	while(i > 0) {
+		int64_t parent = (i - 1) / PQ_ARITY;
+		
+		if(q->priorities[parent] <= prio) {
+			break;
+		}
+		
+		q->priorities[i] = q->priorities[parent];
+		q->values[i] = q->values[parent];
+		i = parent;
+	}
+	
+	q->priorities[i] = prio;
+	q->values[i] = item;
+	return NULL_VALUE;
+}
+
+Value builtin_pq_pop(int64_t cur_line, Value queue)
+{
+	PQueue *q = check_pqueue(cur_line, queue, "pq_pop");
+	
+	if(q->length == 0) {
+		error(cur_line, "pq_pop() from an empty priority queue");
+	}
+	
+	Value result = q->values[0];
+	q->length --;
+	int64_t prio = q->priorities[q->length];
+	Value item = q->values[q->length];
+	int64_t i = 0;
+	
+	while(true) {
+		int64_t first = i * PQ_ARITY + 1;
+		
+		if(first >= q->length) {
+			break;
+		}
+		
+		int64_t last = first + PQ_ARITY < q->length ?
+			first + PQ_ARITY : q->length;
+		
+		int64_t min = first;
+		
+		for(int64_t child = first + 1; child < last; child++) {
+			if(q->priorities[child] < q->priorities[min]) {
+				min = child;
+			}
+		}
+		
+		if(prio <= q->priorities[min]) {
+			break;
+		}
+		
+		q->priorities[i] = q->priorities[min];
+		q->values[i] = q->values[min];
+		i = min;
+	}
 	
-	Value result = func->func(func->enclosed, args);
-	va_end(args);
+	q->priorities[i] = prio;
+	q->values[i] = item;
 	return result;
 }
 
-Value *subscript(int64_t cur_line, Value array, Value index)
+// sort() uses an LSD radix sort on the raw integers when all items are
+// integers. Everything else is sorted with an introsort. It calls the
+// comparator if there is one. Otherwise it uses a fixed order: numbers
+// first, then strings, then all other objects by type and address. The
+// introsort only ever swaps items inside the array, so every value stays
+// reachable while a comparator runs.
+
+typedef struct Sorter {
+	int64_t cur_line;
+	Value compare;
+	Array *array;
+	int64_t offset;
+	int64_t length;
+} Sorter;
+
+static void radix_sort(uint64_t *keys, int64_t length)
 {
-	if(array.type != TY_ARRAY) {
-		error(cur_line, "this is not an array");
+	uint64_t *buf = malloc(length * sizeof(uint64_t));
+	uint64_t *from = keys;
+	uint64_t *to = buf;
+	
+	for(int64_t shift = 0; shift < 64; shift += 8) {
+		int64_t offsets[256] = {0};
+		
+		for(int64_t i=0; i < length; i++) {
+			offsets[from[i] >> shift & 0xff] ++;
+		}
+		
+		if(offsets[from[0] >> shift & 0xff] == length) {
+			continue;
+		}
+		
+		for(int64_t i=0, sum=0; i < 256; i++) {
+			int64_t count = offsets[i];
+			offsets[i] = sum;
+			sum += count;
+		}
+		
+		for(int64_t i=0; i < length; i++) {
+			to[offsets[from[i] >> shift & 0xff] ++] = from[i];
+		}
+		
+		uint64_t *tmp = from;
+		from = to;
+		to = tmp;
+	}
+	
+	if(from != keys) {
+		memcpy(keys, from, length * sizeof(uint64_t));
+	}
+	
+	free(buf);
+}
+
+static int compare_values(Value a, Value b)
+{
+	bool a_num = a.type <= TY_FLOAT;
+	bool b_num = b.type <= TY_FLOAT;
+	
+	if(a.type <= TY_INT && b.type <= TY_INT) {
+		return (a.value > b.value) - (a.value < b.value);
+	}
+	else if(a_num && b_num) {
+		double x = a.type == TY_FLOAT ? a.floatval : a.value;
+		double y = b.type == TY_FLOAT ? b.floatval : b.value;
+		return (x > y) - (x < y);
+	}
+	else if(a_num || b_num) {
+		return a_num ? -1 : 1;
+	}
+	else if(a.type != b.type) {
+		return a.type < b.type ? -1 : 1;
+	}
+	else if(a.type == TY_STRING) {
+		return strcmp(a.string, b.string);
+	}
+	
+	uintptr_t x = (uintptr_t)a.ptr;
+	uintptr_t y = (uintptr_t)b.ptr;
+	return (x > y) - (x < y);
+}
+
+static Value sort_get(Sorter *sorter, int64_t index)
+{
+	return sorter->array->items[sorter->offset + index];
+}
+
+static void sort_swap(Sorter *sorter, int64_t i, int64_t j)
+{
+	Value *items = sorter->array->items + sorter->offset;
+	Value tmp = items[i];
+	items[i] = items[j];
+	items[j] = tmp;
+}
+
+static bool sort_less(Sorter *sorter, int64_t i, int64_t j)
+{
+	Value a = sort_get(sorter, i);
+	Value b = sort_get(sorter, j);
+	
+	if(sorter->compare.type == TY_NULL) {
+		return compare_values(a, b) < 0;
+	}
+	
+	bool less = truthy(call(sorter->cur_line, sorter->compare, 2, (Value[]){a, b}));
+	
+	if(sorter->array->length < sorter->offset + sorter->length) {
+		error(sorter->cur_line, "array was shrunk during sort()");
+	}
+	
+	return less;
+}
+
+static void insertion_sort(Sorter *sorter, int64_t lo, int64_t hi)
+{
+	for(int64_t i = lo + 1; i < hi; i++) {
+		for(int64_t j = i; j > lo && sort_less(sorter, j, j - 1); j--) {
+			sort_swap(sorter, j, j - 1);
+		}
+	}
+}
+
+static void sift_down(Sorter *sorter, int64_t lo, int64_t root, int64_t n)
+{
+	while(2 * root + 1 < n) {
+		int64_t child = 2 * root + 1;
+		
+		if(child + 1 < n && sort_less(sorter, lo + child, lo + child + 1)) {
+			child ++;
+		}
+		
+		if(!sort_less(sorter, lo + root, lo + child)) {
+			break;
+		}
+		
+		sort_swap(sorter, lo + root, lo + child);
+		root = child;
+	}
+}
+
+static void heap_sort(Sorter *sorter, int64_t lo, int64_t hi)
+{
+	int64_t n = hi - lo;
+	
+	for(int64_t i = n / 2 - 1; i >= 0; i--) {
+		sift_down(sorter, lo, i, n);
+	}
+	
+	for(int64_t end = n - 1; end > 0; end--) {
+		sort_swap(sorter, lo, lo + end);
+		sift_down(sorter, lo, 0, end);
+	}
+}
+
+static int64_t partition(Sorter *sorter, int64_t lo, int64_t hi)
+{
+	int64_t mid = lo + (hi - lo) / 2;
+	
+	// median of three moved to lo as the pivot
+	if(sort_less(sorter, mid, lo)) {
+		sort_swap(sorter, mid, lo);
+	}
+	
+	if(sort_less(sorter, hi - 1, mid)) {
+		sort_swap(sorter, hi - 1, mid);
+		
+		if(sort_less(sorter, mid, lo)) {
+			sort_swap(sorter, mid, lo);
+		}
+	}
+	
+	sort_swap(sorter, lo, mid);
+	int64_t i = lo;
+	int64_t j = hi;
+	
+	while(true) {
+		do {
+			i ++;
+		} while(i < hi && sort_less(sorter, i, lo));
+		
+		do {
+			j --;
+		} while(j > lo && sort_less(sorter, lo, j));
+		
+		if(i >= j) {
+			break;
+		}
+		
+		sort_swap(sorter, i, j);
+	}
+	
+	sort_swap(sorter, lo, j);
+	return j;
+}
+
+static void intro_sort(Sorter *sorter, int64_t lo, int64_t hi, int64_t depth)
+{
+	while(hi - lo > 16) {
+		if(depth == 0) {
+			heap_sort(sorter, lo, hi);
+			return;
+		}
+		
+		depth --;
+		int64_t pivot = partition(sorter, lo, hi);
+		
+		if(pivot - lo < hi - pivot) {
+			intro_sort(sorter, lo, pivot, depth);
+			lo = pivot + 1;
+		}
+		else {
+			intro_sort(sorter, pivot + 1, hi, depth);
+			hi = pivot;
+		}
+	}
+	
+	insertion_sort(sorter, lo, hi);
+}
+
+Value builtin_sort(int64_t cur_line, Value array, Value compare)
+{
+	Slice view = array_view(cur_line, array, "sort");
+	bool all_ints = compare.type == TY_NULL;
+	
+	if(compare.type != TY_NULL && compare.type != TY_FUNCTION) {
+		error(cur_line, "sort() needs a function to compare");
+	}
+	
+	if(view.parent.type == TY_INTARRAY) {
+		if(compare.type != TY_NULL) {
+			error(cur_line, "sort() can not use a function on int arrays");
+		}
+	}
+	else {
+		for(int64_t i=0; all_ints && i < view.length; i++) {
+			all_ints = view_get(&view, i).type == TY_INT;
+		}
+	}
+	
+	if(all_ints && view.length > 1) {
+		uint64_t *keys = malloc(view.length * sizeof(uint64_t));
+		
+		for(int64_t i=0; i < view.length; i++) {
+			keys[i] = view_get(&view, i).value ^ (uint64_t)1 << 63;
+		}
+		
+		radix_sort(keys, view.length);
+		
+		for(int64_t i=0; i < view.length; i++) {
+			int64_t value = keys[i] ^ (uint64_t)1 << 63;
+			
+			if(view.parent.type == TY_INTARRAY) {
+				intarray_set(view.parent.intarray, view.offset + i, value);
+			}
+			else {
+				view.parent.array->items[view.offset + i] = INT_VALUE(value);
+			}
+		}
+		
+		free(keys);
+	}
+	else if(view.length > 1) {
+		Sorter sorter = {
+			cur_line, compare, view.parent.array, view.offset, view.length
+		};
+		
+		int64_t depth = 0;
+		
+		for(int64_t n = view.length; n > 1; n /= 2) {
+			depth += 2;
+		}
+		
+		intro_sort(&sorter, 0, view.length, depth);
+	}
+	
+	return array;
+}
+
+Value builtin_clock(int64_t cur_line)
+{
+	return FLOAT_VALUE((double)clock() / CLOCKS_PER_SEC);
+}
+
+// Bitsets pack one bit per item into 64 bit words. Bits beyond the length in
+// the last word are always kept clear, so whole words can be combined and
+// counted without masking.
+
+Value builtin_bitset(int64_t cur_line, Value length)
+{
+	length = check_type(cur_line, TY_INT, TY_INT, length);
+	
+	if(length.value < 0) {
+		error(cur_line, "bitset length must not be negative");
+	}
+	
+	Bitset *bitset = mem_alloc(TY_BITSET, sizeof(Bitset));
+	bitset->length = length.value;
+	bitset->words = calloc((length.value + 63) / 64, sizeof(uint64_t));
+	return BITSET_VALUE(bitset);
+}
+
+static Bitset *check_bitset(int64_t cur_line, Value bitset, char *name)
+{
+	if(bitset.type != TY_BITSET) {
+		error(cur_line, "%s() needs a bitset", name);
 	}
 	
+	return bitset.bitset;
+}
+
+static int64_t check_bit(
+	int64_t cur_line, Value bitset, Value index, char *name
+) {
+	Bitset *b = check_bitset(cur_line, bitset, name);
+	
 	if(index.type != TY_INT) {
-		error(cur_line, "subscript index is not an integer");
+		error(cur_line, "bit index is not an integer");
 	}
 	
-	if(index.value < 0 || index.value >= array.array->length) {
-		error(cur_line, "array index out of range");
+	if(index.value < 0 || index.value >= b->length) {
+		error(cur_line, "bit index out of range");
 	}
 	
-	return array.array->items + index.value;
+	return index.value;
 }
 
-bool truthy(Value value)
+Value builtin_set(int64_t cur_line, Value bitset, Value index)
 {
-	if(value.type == TY_STRING) {
-		return value.string[0] != 0;
+	int64_t i = check_bit(cur_line, bitset, index, "set");
+	bitset.bitset->words[i / 64] |= (uint64_t)1 << i % 64;
+	return NULL_VALUE;
+}
+
+Value builtin_clear(int64_t cur_line, Value bitset, Value index)
+{
+	int64_t i = check_bit(cur_line, bitset, index, "clear");
+	bitset.bitset->words[i / 64] &= ~((uint64_t)1 << i % 64);
+	return NULL_VALUE;
+}
+
+Value builtin_test(int64_t cur_line, Value bitset, Value index)
+{
+	int64_t i = check_bit(cur_line, bitset, index, "test");
+	return BOOL_VALUE(bitset.bitset->words[i / 64] >> i % 64 & 1);
+}
+
+static int64_t check_bitsets(int64_t cur_line, Value a, Value b, char *name)
+{
+	Bitset *left = check_bitset(cur_line, a, name);
+	Bitset *right = check_bitset(cur_line, b, name);
+	
+	if(left->length != right->length) {
+		error(cur_line, "%s() needs bitsets of the same length", name);
 	}
-	else if(value.type == TY_ARRAY) {
-		return value.array->length != 0;
+	
+	return (left->length + 63) / 64;
+}
+
+Value builtin_union(int64_t cur_line, Value a, Value b)
+{
+	int64_t count = check_bitsets(cur_line, a, b, "union");
+	
+	for(int64_t i=0; i < count; i++) {
+		a.bitset->words[i] |= b.bitset->words[i];
 	}
-	else if(value.type == TY_FUNCTION) {
-		return true;
+	
+	return a;
+}
+
+Value builtin_intersect(int64_t cur_line, Value a, Value b)
+{
+	int64_t count = check_bitsets(cur_line, a, b, "intersect");
+	
+	for(int64_t i=0; i < count; i++) {
+		a.bitset->words[i] &= b.bitset->words[i];
 	}
 	
-	return value.value;
+	return a;
+}
+
+Value builtin_count(int64_t cur_line, Value bitset)
+{
+	Bitset *b = check_bitset(cur_line, bitset, "count");
+	int64_t count = 0;
+	
+	for(int64_t i=0; i < (b->length + 63) / 64; i++) {
+		count += __builtin_popcountll(b->words[i]);
+	}
+	
+	return INT_VALUE(count);
+}
+
+static Map *check_map(int64_t cur_line, Value map, char *name)
+{
+	if(map.type != TY_MAP) {
+		error(cur_line, "%s() needs a map", name);
+	}
+	
+	return map.map;
+}
+
+Value builtin_has(int64_t cur_line, Value map, Value key)
+{
+	if(map.type == TY_OMAP) {
+		return BOOL_VALUE(
+			key.type != TY_NULL &&
+			omap_find(map.omap, omap_key(cur_line, key))
+		);
+	}
+	
+	Map *m = check_map(cur_line, map, "has");
+	
+	return BOOL_VALUE(
+		key.type != TY_NULL && map_find(m, key, hash_key(cur_line, key)) >= 0
+	);
+}
+
+Value builtin_erase(int64_t cur_line, Value map, Value key)
+{
+	if(map.type == TY_OMAP) {
+		OMap *m = map.omap;
+		
+		if(key.type == TY_NULL || !m->root) {
+			return BOOL_VALUE(false);
+		}
+		
+		bool found = omap_erase(m->root, omap_key(cur_line, key));
+		
+		if(m->root->count == 0 && !m->root->leaf) {
+			OMapNode *root = m->root;
+			m->root = root->children[0];
+			free(root);
+		}
+		
+		m->length -= found;
+		return BOOL_VALUE(found);
+	}
+	
+	Map *m = check_map(cur_line, map, "erase");
+	
+	if(key.type == TY_NULL) {
+		return BOOL_VALUE(false);
+	}
+	
+	int64_t slot = map_find(m, key, hash_key(cur_line, key));
+	
+	if(slot >= 0) {
+		m->ctrl[slot] = MAP_DELETED;
+		m->tombstones ++;
+		m->length --;
+	}
+	
+	return BOOL_VALUE(slot >= 0);
+}
+
+static void omap_keys(OMapNode *node, Array *keys)
+{
+	for(int64_t i=0; i <= node->count; i++) {
+		if(!node->leaf) {
+			omap_keys(node->children[i], keys);
+		}
+		
+		if(i < node->count) {
+			keys->items[keys->length] = INT_VALUE(node->keys[i]);
+			keys->length ++;
+		}
+	}
+}
+
+Value builtin_keys(int64_t cur_line, Value map)
+{
+	if(map.type == TY_OMAP) {
+		OMap *m = map.omap;
+		Array *keys = new_array(0);
+		keys->items = realloc(keys->items, m->length * sizeof(Value));
+		keys->capacity = m->length;
+		
+		if(m->root) {
+			omap_keys(m->root, keys);
+		}
+		
+		return ARRAY_VALUE(keys);
+	}
+	
+	Map *m = check_map(cur_line, map, "keys");
+	Array *keys = new_array(0);
+	keys->items = realloc(keys->items, m->length * sizeof(Value));
+	keys->capacity = m->length;
+	
+	for(int64_t i=0; i < m->capacity; i++) {
+		if(m->ctrl[i] < MAP_EMPTY) {
+			keys->items[keys->length] = m->entries[i].key;
+			keys->length ++;
+		}
+	}
+	
+	return ARRAY_VALUE(keys);
+}
+
+Value builtin_omap(int64_t cur_line)
+{
+	return OMAP_VALUE(mem_alloc(TY_OMAP, sizeof(OMap)));
+}
+
+// Returns the smallest key not less than key, or null if there is none. Calling
+// it again with the last key + 1 walks the map in order without building an
+// array of keys.
+
+Value builtin_lower_bound(int64_t cur_line, Value map, Value key)
+{
+	if(map.type != TY_OMAP) {
+		error(cur_line, "lower_bound() needs an ordered map");
+	}
+	
+	int64_t k = omap_key(cur_line, key);
+	OMapNode *node = map.omap->root;
+	Value result = NULL_VALUE;
+	
+	while(node) {
+		int64_t i = node_search(node, k);
+		
+		if(i < node->count) {
+			result = INT_VALUE(node->keys[i]);
+			
+			if(node->keys[i] == k) {
+				break;
+			}
+		}
+		
+		node = node->leaf ? 0 : node->children[i];
+	}
+	
+	return result;
 }
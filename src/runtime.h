@@ -11,35 +11,42 @@
 #define BOOL_VALUE(v)         ((Value)BOOL_VALUE_INIT(v))
 #define INT_VALUE_INIT(v)     {.type = TY_INT, .value = v}
 #define INT_VALUE(v)          ((Value)INT_VALUE_INIT(v))
+#define FLOAT_VALUE_INIT(v)   {.type = TY_FLOAT, .floatval = v}
+#define FLOAT_VALUE(v)        ((Value)FLOAT_VALUE_INIT(v))
 #define STRING_VALUE_INIT(v)  {.type = TY_STRING, .string = v}
 #define STRING_VALUE(v)       ((Value)STRING_VALUE_INIT(v))
 
 #define ARRAY_VALUE(v)     ((Value){.type = TY_ARRAY, .array = v})
-#define NEW_ARRAY(...)     ARRAY_VALUE(new_array(__VA_ARGS__))
+#define NEW_ARRAY(length)  ARRAY_VALUE(new_array(length))
+#define NEW_ARRAY_FROM(...) ARRAY_VALUE(new_array_from(__VA_ARGS__))
+#define INTARRAY_VALUE(v)  ((Value){.type = TY_INTARRAY, .intarray = v})
+#define SLICE_VALUE(v)     ((Value){.type = TY_SLICE, .slice = v})
+#define BITSET_VALUE(v)    ((Value){.type = TY_BITSET, .bitset = v})
+#define DEQUE_VALUE(v)     ((Value){.type = TY_DEQUE, .deque = v})
+#define PQUEUE_VALUE(v)    ((Value){.type = TY_PQUEUE, .pqueue = v})
+#define MAP_VALUE(v)       ((Value){.type = TY_MAP, .map = v})
+#define NEW_MAP()          MAP_VALUE(new_map())
+#define OMAP_VALUE(v)      ((Value){.type = TY_OMAP, .omap = v})
+#define STRUCT_VALUE(v)    ((Value){.type = TY_STRUCT, .structure = v})
+
+// The caller stores the type and the payload of an argument separately, so the
+// callee loads them separately too. One 16 byte load of both would stall until
+// the stores are done instead of being forwarded from them.
+#define ARG_VALUE(arg)     ((Value){.type = (arg).type, .value = (arg).value})
+#define NEW_STRUCT(shape)  STRUCT_VALUE(new_struct(shape))
 #define FUNCTION_VALUE(v)  ((Value){.type = TY_FUNCTION, .func = v})
 #define NEW_FUNCTION(...)  FUNCTION_VALUE(new_function(__VA_ARGS__))
 
 #define UNINITIALIZED  {.type = TYX_UNINITIALIZED}
 
-#define REFERENCE(v) ((Value){.type = TYX_REFERENCE, .ref = (v)})
+#define OMAP_DEGREE    8
+#define OMAP_MAX_KEYS  (2 * OMAP_DEGREE - 1)
 
-#define BINOP(l, t, left, op, right) \
-	(Value){ \
-		.type = t, \
-		.value = check_type( \
-			l, TY_NULL, TY_INT, (left) \
-		).value op check_type( \
-			l, TY_NULL, TY_INT, (right) \
-		).value \
-	} \
+#define REFERENCE(v) ((Value){.type = TYX_REFERENCE, .ref = (v)})
 
-#define INT_UNARY(l, op, right) \
-	(Value){ \
-		.type = TY_INT, \
-		.value = op check_type( \
-			l, TY_NULL, TY_INT, (right) \
-		).value \
-	} \
+#define LIKELY(x)    __builtin_expect(!!(x), 1)
+#define UNLIKELY(x)  __builtin_expect(!!(x), 0)
+#define COLD         __attribute__((cold, noinline))
 
 #define PUSH_SCOPE(scope, func_name) \
 	cur_scope_frame = &(ScopeFrame){ \
@@ -82,8 +89,17 @@ typedef enum {
 	TY_NULL,
 	TY_BOOL,
 	TY_INT,
+	TY_FLOAT,
 	TY_STRING,
 	TY_ARRAY,
+	TY_INTARRAY,
+	TY_SLICE,
+	TY_BITSET,
+	TY_DEQUE,
+	TY_PQUEUE,
+	TY_MAP,
+	TY_OMAP,
+	TY_STRUCT,
 	TY_FUNCTION,
 	
 	TYX_UNINITIALIZED,
@@ -95,8 +111,17 @@ typedef struct Value {
 	
 	union {
 		int64_t value;
+		double floatval;
 		char *string;
 		struct Array *array;
+		struct IntArray *intarray;
+		struct Slice *slice;
+		struct Bitset *bitset;
+		struct Deque *deque;
+		struct PQueue *pqueue;
+		struct Map *map;
+		struct OMap *omap;
+		struct Struct *structure;
 		struct Function *func;
 		void *ptr;
 		struct Value *ref;
@@ -105,10 +130,86 @@ typedef struct Value {
 
 typedef struct Array {
 	int64_t length;
-	Value items[];
+	int64_t capacity;
+	Value *items;
 } Array;
 
-typedef Value (*FuncPtr)(Value *enclosed, va_list args);
+typedef enum {
+	IK_INT64,
+	IK_INT32,
+	IK_UINT8,
+} IntKind;
+
+typedef struct IntArray {
+	int64_t length;
+	int64_t capacity;
+	IntKind kind;
+	void *items;
+} IntArray;
+
+typedef struct Slice {
+	Value parent;
+	int64_t offset;
+	int64_t length;
+} Slice;
+
+typedef struct Bitset {
+	int64_t length;
+	uint64_t *words;
+} Bitset;
+
+typedef struct Deque {
+	int64_t length;
+	int64_t capacity;
+	int64_t head;
+	Value *items;
+} Deque;
+
+typedef struct PQueue {
+	int64_t length;
+	int64_t capacity;
+	int64_t *priorities;
+	Value *values;
+} PQueue;
+
+typedef struct MapEntry {
+	Value key;
+	Value value;
+} MapEntry;
+
+typedef struct Map {
+	int64_t length;
+	int64_t capacity;
+	int64_t tombstones;
+	uint8_t *ctrl;
+	MapEntry *entries;
+} Map;
+
+typedef struct OMapNode {
+	int64_t count;
+	bool leaf;
+	int64_t keys[OMAP_MAX_KEYS];
+	Value values[OMAP_MAX_KEYS];
+	struct OMapNode *children[OMAP_MAX_KEYS + 1];
+} OMapNode;
+
+typedef struct OMap {
+	int64_t length;
+	OMapNode *root;
+} OMap;
+
+typedef struct Shape {
+	char *name;
+	int64_t field_count;
+	char **fields;
+} Shape;
+
+typedef struct Struct {
+	Shape *shape;
+	Value fields[];
+} Struct;
+
+typedef Value (*FuncPtr)(Value *enclosed, Value *args);
 
 typedef struct Function {
 	FuncPtr func;
@@ -117,6 +218,23 @@ typedef struct Function {
 	Value enclosed[];
 } Function;
 
+typedef enum {
+	MEMO_LRU,
+	MEMO_FIFO,
+	MEMO_KEEP,
+} MemoPolicy;
+
+typedef struct Memo {
+	struct Memo *next;
+	int64_t arity;
+	int64_t capacity;
+	MemoPolicy policy;
+	int64_t set_count;
+	uint64_t clock;
+	uint64_t *stamps;
+	Value *slots;
+} Memo;
+
 typedef struct Temp {
 	struct Temp *prev;
 	Value value;
@@ -132,22 +250,291 @@ typedef struct ScopeFrame {
 
 typedef struct MemBlock {
 	struct MemBlock *next;
+	Type type;
 	int64_t mark;
 	char data[];
 } MemBlock;
 
-Value *check_var(int64_t cur_line, Value *var, char *name);
+static inline int64_t intarray_get(IntArray *array, int64_t index)
+{
+	switch(array->kind) {
+		case IK_INT64:
+			return ((int64_t*)array->items)[index];
+		case IK_INT32:
+			return ((int32_t*)array->items)[index];
+		case IK_UINT8:
+			return ((uint8_t*)array->items)[index];
+	}
+	
+	return 0;
+}
+
+static inline void intarray_set(IntArray *array, int64_t index, int64_t value)
+{
+	switch(array->kind) {
+		case IK_INT64:
+			((int64_t*)array->items)[index] = value;
+			break;
+		case IK_INT32:
+			((int32_t*)array->items)[index] = value;
+			break;
+		case IK_UINT8:
+			((uint8_t*)array->items)[index] = value;
+			break;
+	}
+}
+
+// The checks of the runtime are inlined into the generated code, while their
+// error reporting stays out of line in cold functions.
+
+COLD Value *shape_mismatch(int64_t cur_line, Value value, Shape *shape);
+COLD Value *var_undefined(int64_t cur_line, char *name);
+COLD Value wrong_type(int64_t cur_line);
+COLD Value call_failed(int64_t cur_line, Value value, int64_t argcount);
+COLD Value *function_uninitialized(int64_t cur_line);
+COLD int64_t division_by_zero(int64_t cur_line);
+
+static inline Value *struct_field(
+	int64_t cur_line, Value value, Shape *shape, int64_t offset
+) {
+	if(UNLIKELY(
+		value.type != TY_STRUCT || value.structure->shape != shape
+	)) {
+		return shape_mismatch(cur_line, value, shape);
+	}
+	
+	return value.structure->fields + offset;
+}
+
+static inline Value *check_var(int64_t cur_line, Value *var, char *name)
+{
+	if(UNLIKELY(var->type == TYX_UNINITIALIZED)) {
+		return var_undefined(cur_line, name);
+	}
+	
+	return var;
+}
+
+static inline Value check_type(
+	int64_t cur_line, Type mintype, Type maxtype, Value value
+) {
+	if(UNLIKELY(value.type < mintype || value.type > maxtype)) {
+		return wrong_type(cur_line);
+	}
+	
+	return value;
+}
+
 void print(int64_t num, ...);
-Value check_type(int64_t cur_line, Type mintype, Type maxtype, Value value);
-Array *new_array(int64_t length, ...);
+Array *new_array(int64_t length);
+Array *new_array_from(int64_t length, const Value *template);
+
+Map *new_map();
+Struct *new_struct(Shape *shape);
+Value *struct_field_named(int64_t cur_line, Value value, char *name);
+void map_set(int64_t cur_line, Map *map, Value key, Value value);
 
 Function *new_function(
 	FuncPtr funcptr, int64_t arity, int64_t enclosed_count, ...
 );
 
-Value call(int64_t cur_line, Value value, int64_t argcount, ...);
-Value *subscript(int64_t cur_line, Value array, Value index);
-bool truthy(Value value);
+static inline Value call(
+	int64_t cur_line, Value value, int64_t argcount, Value *args
+) {
+	if(UNLIKELY(
+		value.type != TY_FUNCTION || value.func->arity != argcount
+	)) {
+		return call_failed(cur_line, value, argcount);
+	}
+	
+	return value.func->func(value.func->enclosed, args);
+}
+
+Value *memo_find(Memo *memo, Value *args);
+Value memo_store(Memo *memo, Value *args, Value result);
+
+static inline Value *function_enclosed(int64_t cur_line, Value value)
+{
+	if(UNLIKELY(value.type != TY_FUNCTION)) {
+		return function_uninitialized(cur_line);
+	}
+	
+	return value.func->enclosed;
+}
+
+Value subscript_any(int64_t cur_line, Value array, Value index);
+
+static inline Value subscript(int64_t cur_line, Value array, Value index)
+{
+	if(LIKELY(
+		array.type == TY_ARRAY && index.type == TY_INT &&
+		(uint64_t)index.value < (uint64_t)array.array->length
+	)) {
+		return array.array->items[index.value];
+	}
+	
+	return subscript_any(cur_line, array, index);
+}
+
+Value slice(int64_t cur_line, Value array, Value start, Value stop);
+
+void assign_subscript(
+	int64_t cur_line, Value array, Value index, Value value
+);
+
+bool truthy_any(Value value);
+
+static inline bool truthy(Value value)
+{
+	if(LIKELY(value.type <= TY_INT)) {
+		return value.value;
+	}
+	
+	return truthy_any(value);
+}
+
+static inline double float_operand(int64_t cur_line, Value value)
+{
+	if(value.type == TY_FLOAT) {
+		return value.floatval;
+	}
+	
+	return check_type(cur_line, TY_NULL, TY_INT, value).value;
+}
+
+static inline int64_t int_div(int64_t cur_line, int64_t left, int64_t right)
+{
+	if(UNLIKELY(right == 0)) {
+		return division_by_zero(cur_line);
+	}
+	
+	return left / right;
+}
+
+static inline int64_t int_mod(int64_t cur_line, int64_t left, int64_t right)
+{
+	if(UNLIKELY(right == 0)) {
+		return division_by_zero(cur_line);
+	}
+	
+	return left % right;
+}
+
+#define ARITH_BINOP(name, op) \
+	static inline Value binop_ ## name( \
+		int64_t cur_line, Value left, Value right \
+	) { \
+		if(left.type <= TY_INT && right.type <= TY_INT) { \
+			return INT_VALUE(left.value op right.value); \
+		} \
+		\
+		return FLOAT_VALUE( \
+			float_operand(cur_line, left) op float_operand(cur_line, right) \
+		); \
+	} \
+
+// cmp_* is used directly as the condition of if and while statements, so the
+// comparison compiles to a compare and branch without building a bool Value.
+
+#define CMP_BINOP(name, op) \
+	static inline bool cmp_ ## name( \
+		int64_t cur_line, Value left, Value right \
+	) { \
+		if(LIKELY(left.type <= TY_INT && right.type <= TY_INT)) { \
+			return left.value op right.value; \
+		} \
+		\
+		return float_operand(cur_line, left) op float_operand(cur_line, right); \
+	} \
+	\
+	static inline Value binop_ ## name( \
+		int64_t cur_line, Value left, Value right \
+	) { \
+		return BOOL_VALUE(cmp_ ## name(cur_line, left, right)); \
+	} \
+
+ARITH_BINOP(add, +)
+ARITH_BINOP(sub, -)
+ARITH_BINOP(mul, *)
+CMP_BINOP(lt, <)
+CMP_BINOP(gt, >)
+CMP_BINOP(eq, ==)
+CMP_BINOP(ne, !=)
+CMP_BINOP(le, <=)
+CMP_BINOP(ge, >=)
+
+static inline Value binop_div(int64_t cur_line, Value left, Value right)
+{
+	if(left.type <= TY_INT && right.type <= TY_INT) {
+		return INT_VALUE(int_div(cur_line, left.value, right.value));
+	}
+	
+	return FLOAT_VALUE(
+		float_operand(cur_line, left) / float_operand(cur_line, right)
+	);
+}
+
+static inline Value binop_mod(int64_t cur_line, Value left, Value right)
+{
+	return INT_VALUE(int_mod(
+		cur_line,
+		check_type(cur_line, TY_NULL, TY_INT, left).value,
+		check_type(cur_line, TY_NULL, TY_INT, right).value
+	));
+}
+
+static inline Value unary_pos(int64_t cur_line, Value value)
+{
+	if(value.type == TY_FLOAT) {
+		return value;
+	}
+	
+	return INT_VALUE(check_type(cur_line, TY_NULL, TY_INT, value).value);
+}
+
+static inline Value unary_neg(int64_t cur_line, Value value)
+{
+	if(value.type == TY_FLOAT) {
+		return FLOAT_VALUE(-value.floatval);
+	}
+	
+	return INT_VALUE(-check_type(cur_line, TY_NULL, TY_INT, value).value);
+}
+
+Value builtin_len(int64_t cur_line, Value value);
+Value builtin_push(int64_t cur_line, Value array, Value item);
+Value builtin_pop(int64_t cur_line, Value array);
+Value builtin_deque(int64_t cur_line);
+Value builtin_push_front(int64_t cur_line, Value deque, Value item);
+Value builtin_pop_front(int64_t cur_line, Value deque);
+Value builtin_int64_array(int64_t cur_line, Value length);
+Value builtin_int32_array(int64_t cur_line, Value length);
+Value builtin_uint8_array(int64_t cur_line, Value length);
+Value builtin_fill(int64_t cur_line, Value array, Value value);
+
+Value builtin_copy(
+	int64_t cur_line, Value dst, Value dstoff, Value src, Value srcoff,
+	Value count
+);
+
+Value builtin_equal(int64_t cur_line, Value a, Value b);
+Value builtin_pqueue(int64_t cur_line);
+Value builtin_pq_push(int64_t cur_line, Value queue, Value priority, Value item);
+Value builtin_pq_pop(int64_t cur_line, Value queue);
+Value builtin_sort(int64_t cur_line, Value array, Value compare);
+Value builtin_clock(int64_t cur_line);
+Value builtin_bitset(int64_t cur_line, Value length);
+Value builtin_set(int64_t cur_line, Value bitset, Value index);
+Value builtin_clear(int64_t cur_line, Value bitset, Value index);
+Value builtin_test(int64_t cur_line, Value bitset, Value index);
+Value builtin_union(int64_t cur_line, Value a, Value b);
+Value builtin_intersect(int64_t cur_line, Value a, Value b);
+Value builtin_count(int64_t cur_line, Value bitset);
+Value builtin_has(int64_t cur_line, Value map, Value key);
+Value builtin_erase(int64_t cur_line, Value map, Value key);
+Value builtin_keys(int64_t cur_line, Value map);
+Value builtin_omap(int64_t cur_line);
+Value builtin_lower_bound(int64_t cur_line, Value map, Value key);
 
 extern ScopeFrame *cur_scope_frame;
 
@@ -10,13 +10,13 @@ int main(int argc, char *argv[])
 	module.src =
 		"# a /* test program\n"
 		"function foobar 123456789\"Hello\\nWorld\" =\n"
-		"0xffFFffFFffFFffFF 0b1010"
+		"0xffFFffFFffFFffFF 0b1010 1.5 2e3 x.y"
 	;
 	
 	module.srcsize = strlen(module.src);
 	lex(&module);
 	
-	assert(array_length(module.tokens) == 8);
+	assert(array_length(module.tokens) == 13);
 	
 	assert(module.tokens[0].type == TK_KEYWORD);
 	assert(module.tokens[0].keyword == KW_function);
@@ -40,8 +40,19 @@ int main(int argc, char *argv[])
 	assert(module.tokens[6].type == TK_INT);
 	assert(module.tokens[6].value == 10);
 	
-	assert(module.tokens[7].type == TK_EOF);
-	assert(module.tokens[7].line == 3);
+	assert(module.tokens[7].type == TK_FLOAT);
+	assert(module.tokens[7].floatval == 1.5);
+	
+	assert(module.tokens[8].type == TK_FLOAT);
+	assert(module.tokens[8].floatval == 2000);
+	
+	assert(module.tokens[9].type == TK_IDENT);
+	assert(module.tokens[10].type == TK_PUNCT);
+	assert(module.tokens[10].punct == '.');
+	assert(module.tokens[11].type == TK_IDENT);
+	
+	assert(module.tokens[12].type == TK_EOF);
+	assert(module.tokens[12].line == 3);
 	
 	return 0;
 }
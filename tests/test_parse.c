@@ -54,5 +54,63 @@ int main(int argc, char *argv[])
 		assert(init->value == 90);
 	}
 	
+	{
+		Module module = {0};
+		module.src = "var foo = {1: 2, \"bar\": []};";
+		module.srcsize = strlen(module.src);
+		
+		lex(&module);
+		parse(&module);
+		
+		Expr *init = module.body->stmts->decl->init;
+		assert(init);
+		assert(init->type == EX_MAP);
+		assert(init->length == 2);
+		
+		Expr *key = init->items;
+		assert(key->type == EX_INT);
+		assert(key->next->type == EX_INT);
+		assert(key->next->next->type == EX_STRING);
+		assert(key->next->next->next->type == EX_ARRAY);
+		assert(key->next->next->next->next == 0);
+	}
+	
+	{
+		Module module = {0};
+		module.src = "struct foo { x, y } print bar.y;";
+		module.srcsize = strlen(module.src);
+		
+		lex(&module);
+		parse(&module);
+		
+		Stmt *stmt = module.body->stmts;
+		assert(stmt->type == ST_STRUCTDECL);
+		assert(stmt->decl->isstruct);
+		assert(array_length(stmt->decl->fields) == 2);
+		assert(module.body->scope->decl_count == 0);
+		
+		Expr *value = stmt->next->values;
+		assert(value->type == EX_FIELD);
+		assert(value->object->type == EX_VAR);
+		assert(strcmp(value->field->id, "y") == 0);
+	}
+	
+	{
+		Module module = {0};
+		module.src = "print a[1:], a[:];";
+		module.srcsize = strlen(module.src);
+		
+		lex(&module);
+		parse(&module);
+		
+		Expr *value = module.body->stmts->values;
+		assert(value->type == EX_SLICE);
+		assert(value->index->type == EX_INT);
+		assert(value->stop == 0);
+		assert(value->next->type == EX_SLICE);
+		assert(value->next->index == 0);
+		assert(value->next->stop == 0);
+	}
+	
 	return 0;
 }
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Compiles every program in programs/, plainly and with -O, and compares what
+# it prints on stdout and then on stderr with the .out file beside it.
+
+crispy=$(realpath ../crispy)
+cache_dir="$HOME/.crispy"
+stderr_file=$(mktemp)
+failed=0
+
+# the executable name that build.c derives from the source path
+path_id() {
+	printf '%s' "$1" | od -An -v -tu1 | tr -s ' ' '\n' | awk 'NF {
+		c = $1
+		if(c >= 48 && c <= 57 || c >= 65 && c <= 90 || c >= 97 && c <= 122) {
+			printf "%c", c
+		}
+		else {
+			printf "_%c%c", int(c / 16) + 65, c % 16 + 65
+		}
+	}'
+}
+
+for program in programs/*.cr; do
+	path=$(realpath "$program")
+	exe="$cache_dir/$(path_id "$path")"
+	expected="${program%.cr}.out"
+	
+	for flags in "" "-O"; do
+		rm -f "$exe"
+		"$crispy" $flags "$path" > /dev/null 2>&1
+		
+		if [ ! -x "$exe" ]; then
+			echo "FAIL $program $flags: does not compile"
+			failed=1
+			continue
+		fi
+		
+		actual=$("$exe" 2> "$stderr_file"; cat "$stderr_file")
+		
+		if [ "$actual" != "$(cat "$expected")" ]; then
+			echo "FAIL $program $flags"
+			echo "$actual" | diff "$expected" - | head -20
+			failed=1
+		fi
+	done
+done
+
+rm -f "$stderr_file"
+
+if [ $failed = 0 ]; then
+	echo "all programs passed"
+fi
+
+exit $failed